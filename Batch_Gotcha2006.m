@@ -136,9 +136,12 @@ data = SpotlightBasic(data,Center,View);
 
 data.orig_size = orig_size;
 
-% Save the data
+% Save the data, with its size stored separately so that the pass
+% assembler can presize its arrays without loading the phase history
+chunkInfo.K = data.K;
+chunkInfo.Np = data.Np;
 resultName = sprintf('blding620_FP%03d_%03d', pass, num);
-save(strcat(resultPath,resultName),'data');
+save(strcat(resultPath,resultName),'data','chunkInfo');
 fprintf('Saved file %s/n', strcat(resultPath,resultName))
 
 fprintf('Finished with section %d\n',num);
@@ -51,118 +51,164 @@ yImage=y_min+Res_y:Res_y:y_max;
 
 %The images will be stored in a file named resultsName_passNuber.mat
 resultsName = strcat(folders, '/full_2d');
+
+% Autofocus results and images are also stored under a hash of their
+% inputs (see stageCache.m) so that reruns skip unchanged work
+cacheDir = strcat(folders, '/stageCache');
  
 
 %% Performing auto-focus on the phase-history measurements
 for idxPass = 1:length(uniqueStr)
 
-    phdata=[]; % phase-history data after auto-focus
-    freq=[]; % frequencies used
-    x=[]; % x-location of radar
-    y=[]; % y-location of radar
-    z=[]; % z-location of radar
-    r0=[]; % scene center
-    th=[]; % azimuth
-    phi=[]; % elevation
-    rCorrectEstSave = []; %range-correction factor
-    phaseEstSave = []; % phase-correction factor
-    phdataOriginal = []; % original phase-history meassurements
+    numFreqSamples = 1981; % every pulse is zero-padded/truncated to this
     
     % extract the indices of files from the current pass
     indexFiles =  find(contains({d1.name},uniqueStr{idxPass})==1);
+    fileNames = arrayfun(@(f)sprintf('%s%s%s',f.folder,filesep,f.name),...
+        d1(indexFiles),'UniformOutput',false);
+    
+    % Presize the pass from the chunk metadata written by Batch_Gotcha2006.m
+    % so that every chunk is written into place instead of growing the
+    % arrays by concatenation. Chunks without metadata are assumed to be as
+    % large as the median known chunk (8192 pulses when none is known) and
+    % the arrays grow geometrically if that guess is too small.
+    numPulsesFile = nan(1,length(fileNames));
+    for idxFiles= 1:length(fileNames)
+        if ismember('chunkInfo',who('-file',fileNames{idxFiles}))
+            info = load(fileNames{idxFiles},'chunkInfo');
+            numPulsesFile(idxFiles) = info.chunkInfo.Np;
+        end
+    end
+    known = ~isnan(numPulsesFile);
+    capacity = sum(numPulsesFile(known));
+    if any(known)
+        guess = median(numPulsesFile(known));
+    else
+        guess = 8192;
+    end
+    capacity = capacity + sum(~known)*max(1,round(guess));
+    
+    phdata=zeros(numFreqSamples,capacity); % phase-history data after auto-focus
+    freq=zeros(numFreqSamples,capacity); % frequencies used
+    x=zeros(1,capacity); % x-location of radar
+    y=zeros(1,capacity); % y-location of radar
+    z=zeros(1,capacity); % z-location of radar
+    r0=zeros(1,capacity); % scene center
+    th=zeros(1,capacity); % azimuth
+    phi=zeros(1,capacity); % elevation
+    rCorrectEstSave = zeros(1,capacity); %range-correction factor
+    phaseEstSave = zeros(1,capacity); % phase-correction factor
+    numTotal = 0; % pulses written so far
     
-    for idxFiles= 1:length(indexFiles)
+    for idxFiles= 1:length(fileNames)
         fprintf('prcessing image %d in pass %d\n',idxFiles,idxPass);
         
-        load(sprintf('%s%s%s',d1(indexFiles(idxFiles)).folder,filesep,d1(indexFiles(idxFiles)).name));
+        load(fileNames{idxFiles},'data');
         
-        numFreqSamples = size(data.phdata,1);
         numPulses = size(data.phdata,2);
         
-        if numFreqSamples < 1981
-            data.deltaF=3.231472355518341e+05;
-            data.phdata=[data.phdata ;zeros(1981-numFreqSamples,numPulses)];
-        elseif numFreqSamples > 1981
-                data.phdata=data.phdata(1:1981,:);
+        if size(data.phdata,1) < numFreqSamples
+            data.phdata=[data.phdata ;zeros(numFreqSamples-size(data.phdata,1),numPulses)];
+        elseif size(data.phdata,1) > numFreqSamples
+                data.phdata=data.phdata(1:numFreqSamples,:);
         end
         
-        numFreqSamples =1981;
-        data.K=1981;
+        data.K=numFreqSamples;
         data.deltaF=  3.231472355518341e+05;
         
+        if numTotal + numPulses > capacity
+            % metadata missing or wrong: grow geometrically
+            capacity = max(2*capacity,numTotal + numPulses);
+            phdata(:,capacity) = 0;
+            freq(:,capacity) = 0;
+            x(capacity) = 0;
+            y(capacity) = 0;
+            z(capacity) = 0;
+            r0(capacity) = 0;
+            th(capacity) = 0;
+            phi(capacity) = 0;
+            rCorrectEstSave(capacity) = 0;
+            phaseEstSave(capacity) = 0;
+        end
+        cols = numTotal + (1:numPulses);
+        numTotal = numTotal + numPulses;
+        
         freqTemp =double(data.minF) + data.deltaF*(0:numFreqSamples-1).';
-        freq = [freq freqTemp];
+        freq(:,cols) = freqTemp;
         thTemp=double(data.azim);
        % thTemp(thTemp <0) =thTemp(thTemp <0) + 2*pi;  % making angles between 0 to 2*pi
         
-        x = [x double(data.AntX)];
-        y = [y double(data.AntY)];
-        z = [z double(data.AntZ)];
-        r0 = [r0 double(data.R0)];
-        th = [th thTemp]; % assuming azimuth angles are in radians
-        phi = [phi rad2deg(double(data.elev))]; % assuming elevation angle are in radians
+        x(cols) = double(data.AntX);
+        y(cols) = double(data.AntY);
+        z(cols) = double(data.AntZ);
+        r0(cols) = double(data.R0);
+        th(cols) = thTemp; % assuming azimuth angles are in radians
+        phi(cols) = rad2deg(double(data.elev)); % assuming elevation angle are in radians
         
         %% performing auto-focus using prominent point method if flag is enabled
         if (AutoFocusEnable == 1)
-            [p1Final,rCorrectEst,phaseEst]=PPP_autofocus_twoPass(topHat_coordinate_Center_x,...
-                topHat_coordinate_Center_y,topHat_coordinate_Center_z,tophHat_radius,...
-                double(data.phdata), double(data.R0),freqTemp,rad2deg(thTemp),double(data.AntX),...
-                double(data.AntY),double(data.AntZ));
+            [cacheFile,isCached] = stageCache(cacheDir,'autofocus',struct(...
+                'chunkFile',d1(indexFiles(idxFiles)),...
+                'topHatCenter',[topHat_coordinate_Center_x topHat_coordinate_Center_y topHat_coordinate_Center_z],...
+                'topHatRadius',tophHat_radius));
+            if isCached
+                load(cacheFile,'p1Final','rCorrectEst','phaseEst');
+            else
+                [p1Final,rCorrectEst,phaseEst]=PPP_autofocus_twoPass(topHat_coordinate_Center_x,...
+                    topHat_coordinate_Center_y,topHat_coordinate_Center_z,tophHat_radius,...
+                    double(data.phdata), double(data.R0),freqTemp,rad2deg(thTemp),double(data.AntX),...
+                    double(data.AntY),double(data.AntZ));
+                save(cacheFile,'p1Final','rCorrectEst','phaseEst','-v7.3');
+            end
             plot(rCorrectEst);
-            phaseEstSave = [phaseEstSave phaseEst];
-            rCorrectEstSave = [rCorrectEstSave rCorrectEst.'];
-            phdata = [phdata p1Final];
+            phaseEstSave(cols) = phaseEst;
+            rCorrectEstSave(cols) = rCorrectEst.';
+            phdata(:,cols) = p1Final;
         else
-            phdata = [phdata double(data.phdata)];
-        end
-      
-        phdataOriginal =  [phdataOriginal double(data.phdata)];
-        if idxFiles == 1 % store the starting angle from file number 1
-            startingTh =thTemp(1);
+            phdata(:,cols) = double(data.phdata);
         end
+        clear data p1Final;
         
     end
+    
+    if numTotal < capacity
+        % only when the metadata overestimated the pass
+        phdata = phdata(:,1:numTotal);
+        freq = freq(:,1:numTotal);
+        x = x(1:numTotal);
+        y = y(1:numTotal);
+        z = z(1:numTotal);
+        r0 = r0(1:numTotal);
+        th = th(1:numTotal);
+        phi = phi(1:numTotal);
+        rCorrectEstSave = rCorrectEstSave(1:numTotal);
+        phaseEstSave = phaseEstSave(1:numTotal);
+    end
 
 
 
 th = rad2deg(unwrap(th)); % unwrapping the angles to see if there is any mismatch
 
 %     selecting starting angle  to starting angle + 360 degree in azimuth
- %check if it is decreasing  in azimuth, if not flip everything
- 
- if th(1)< th(end)
-     idx=length(th):-1:1;
-     th = th(idx);
-    freq = freq(:,idx);
-    x = x(idx);
-    y = y(idx);
-    z = z(idx);
-    r0 = r0(idx);
-    phi = phi(idx);
-    phdata = phdata(:,idx);
-    phdataOriginal = phdataOriginal(:,idx);
- end
- 
-     
-startingTh=th(1);
-idx = find(th <= startingTh & th > startingTh - 360 );
-th = th(idx);
-freq = freq(:,idx);
-x = x(idx);
-y = y(idx);
-z = z(idx);
-r0 = r0(idx);
-phi = phi(idx);
-phdata = phdata(:,idx);
-phdataOriginal = phdataOriginal(:,idx);
+%check if it is decreasing  in azimuth, if not flip everything.
+% The flip and the 360 degree selection are composed into the index view
+% passIdx; phdata and freq stay in acquisition order and are only gathered
+% per image below, so the pass is never copied as a whole.
+passIdx = 1:numTotal;
+if th(1)< th(end)
+    passIdx = fliplr(passIdx);
+end
+startingTh=th(passIdx(1));
+passIdx = passIdx(th(passIdx) <= startingTh & th(passIdx) > startingTh - 360 );
 
 if (AutoFocusEnable == 1)
-    phaseEstSave = phaseEstSave(idx);
-    rCorrectEstSave = rCorrectEstSave(idx);
+    phaseEstSave = phaseEstSave(passIdx);
+    rCorrectEstSave = rCorrectEstSave(passIdx);
 end
 save(sprintf('%s/phaseHistory_correction_%d_pass',folders,idxPass),'phaseEstSave','rCorrectEstSave','-v7.3');
 
 th = mod(th,360); % wrapping it back to 360
+thView = th(passIdx); % azimuth of the pulses in the view
 
 %% Constructing images using the auto-focussed data.
 %creating 5-degreee images
@@ -172,11 +218,18 @@ azSkip = 360/numImages;
 azCenter = 0:azSkip:360-azSkip;
 
 azSpan = 5; % azSpan degree images will be created
+% 1: update one running image by adding the pulses entering and removing
+% the pulses leaving the azimuth window (formImageSlidingAperture.m)
+% 0: form every image from scratch (formImageSimulationNew.m)
+% It backprojects the pulses of twice the azimuth step per image, so it is
+% only faster when the images overlap by more than half their span
+slidingAperture = double(azSkip < azSpan/2);
+slidingState = [];
 for idxImages =1:numImages
     azMin = mod(azCenter(idxImages) - azSpan/2,360);
     azMax = mod(azCenter(idxImages) + azSpan/2,360);
-    idx1 = find(th < azMax);
-    idx2 = find(th > azMin);
+    idx1 = find(thView < azMax);
+    idx2 = find(thView > azMin);
     if (azCenter(idxImages) - azSpan/2 < 0) ||  (azCenter(idxImages) + azSpan/2 >= 360)
         % handle the boundaries
         idxFinal= [idx2 idx1];
@@ -184,23 +237,41 @@ for idxImages =1:numImages
         % the main part 
         idxFinal = intersect(idx1,idx2);
     end
-    thImage = th(idxFinal);
-    freqImage = freq(:,idxFinal);
-    AntXImage = x(idxFinal);
-    AntYImage = y(idxFinal);
-    AntZImage = z(idxFinal);
-    r0Image = r0(idxFinal);
-    phiImage = phi(idxFinal);
-    phdataImage = phdata(:,idxFinal);
+    pulses = passIdx(idxFinal); % columns of phdata in the image
+    thImage = th(pulses);
+    freqImage = freq(:,pulses);
+    AntXImage = x(pulses);
+    AntYImage = y(pulses);
+    AntZImage = z(pulses);
+    r0Image = r0(pulses);
+    phiImage = phi(pulses);
+    phdataImage = phdata(:,pulses);
     taper_flag =0; % windowing disabled
+    resultsFile = sprintf('%s_%d_%d.mat',resultsName,idxImages,idxPass);
+    
+    [cacheFile,isCached,stageKey] = stageCache(cacheDir,'image2d',struct(...
+        'th',thImage,'phi',phiImage,'phdata',phdataImage,'freq',freqImage(:,1),...
+        'AntX',AntXImage,'AntY',AntYImage,'AntZ',AntZImage,'r0',r0Image,...
+        'Nx',Nx,'Ny',Ny,'sceneExtent',[sceneExtent_x sceneExtent_y],'NFFT',NFFT,...
+        'sceneCenter',[x0 y0],'taper_flag',taper_flag,'xImage',xImage,'yImage',yImage,...
+        'slidingAperture',slidingAperture));
+    if isCached
+        copyfile(cacheFile,resultsFile);
+        continue;
+    end
     
     % forming the image using Wx, Wy, Nfft, x_vec, y_vec from the input
     % data file and assuming it to be constant for all files in the pass.
     
-    data_pass = formImageSimulationNew(phiImage,Nx,Ny, thImage,...
-        phdataImage,freqImage(:,1),sceneExtent_x,sceneExtent_y,NFFT,taper_flag,...
-        AntXImage,AntYImage,AntZImage,r0Image,xImage,yImage,x0,y0);
-    im_final = data_pass.im_final;
+    if slidingAperture == 1
+        [im_final,slidingState] = formImageSlidingAperture(slidingState,pulses,...
+            phdata,freq,x,y,z,r0,NFFT,xImage,yImage);
+    else
+        data_pass = formImageSimulationNew(phiImage,Nx,Ny, thImage,...
+            phdataImage,freqImage(:,1),sceneExtent_x,sceneExtent_y,NFFT,taper_flag,...
+            AntXImage,AntYImage,AntZImage,r0Image,xImage,yImage,x0,y0);
+        im_final = data_pass.im_final;
+    end
     thFinal = thImage;
     freqFinal = freqImage;
     AntXFinal= AntXImage;
@@ -208,9 +279,10 @@ for idxImages =1:numImages
     AntZFinal= AntZImage;
     r0Final = r0Image;
     phiFinal = phiImage;
-    save(sprintf('%s_%d_%d',resultsName,idxImages,idxPass),'freqFinal','AntXFinal',...
+    save(resultsFile,'freqFinal','AntXFinal',...
         'AntYFinal','AntZFinal','r0Final','thFinal','phiFinal','im_final',...
-        'xImage','yImage','-v7.3');
+        'xImage','yImage','stageKey','-v7.3');
+    copyfile(resultsFile,cacheFile);
 end
 
 end
@@ -33,6 +33,71 @@ M_z=numHeightBins;
 D_x = abs(xImage(end) - xImage(1));
 D_y = abs(yImage(end) - yImage(1));
 D_z = 80; % height of scene [-60m,60m]
+optTol = 7e-3; % SPGL1 optimality tolerance
+nufftAccuracy = 6; % digits of accuracy of the 3D NUFFT (M_sp)
+nufftThreads = 0; % threads of the NUFFT gridding (0: one per CPU)
+nufftHugePages = false; % transparent huge pages for the oversampled grid
+nufftPinning = 'none'; % 'none', 'close' or 'spread' (over all sockets)
+nufftMode = 'auto'; % NUFFT plan mode, 'tune' to autotune (FGG_3d_autotune.m)
+multiresFactor = 1; % solve on a grid downsampled by this factor first (1: direct solve, see recovery_3D_experiment.m)
+multiresSupportDb = 40; % dynamic range (dB) of the support taken from the coarse solution
+multiresMargin = 1; % coarse voxels added around that support (coarseToFineRecovery_3D.m)
+debiasIterations = 20; % LSQR iterations refitting the amplitudes of the detected points (0: none)
+densityCompIterations = 0; % Pipe-Menon iterations of the density-compensation weights (0: none, see recovery_3D_experiment.m)
+paretoPoints = 0; % values of tau per root-finding step of spgGroupPareto.m (0: SPGL1)
+svrgEpochs = 0; % SVRG epochs over blocks of pulses before the direct solve (svrgGroupRecovery.m)
+svrgBlocksPerPass = 1; % blocks of consecutive pulses per pass in the SVRG epochs
+volumeFloorDb = 100; % voxels of the solver output within this many dB of the maximum go to Volume_3D_###.mat
+voxelOrder = 'zxy'; % storage order of the voxels, fastest axis first (voxelLayout.m)
+voxelBlock = [1 1 1]; % bricks of voxels in x, y and z ([1 1 1]: no bricks)
+pointDetector = 'threshold'; % 'threshold' (snrThreshold only) or 'cfar' (detectPoints3D.m, on the solver output)
+cfarPfa = 1e-4; % false-alarm rate of the CFAR test
+cfarGuard = [1 1 2]; % [x y z] half sizes of the guard box of the CFAR test
+cfarTrain = [4 4 8]; % [x y z] training voxels beyond the guard box
+peakRadius = 2; % a point must be the largest of its z-column within this many voxels
+tomoMethod = 'none'; % 'capon' or 'beamforming': per-pixel tomography of the passes (tomoHeightEstimate.m)
+tomoWindow = [5 5]; % pixels averaged into the covariance of the tomography
+tomoWarmStart = false; % start the direct solve at the tomographic heights (multiresFactor = 1)
+coregPhaseModel = 'constant'; % residual phase of the passes: 'constant', 'plane' or 'none'
+coregTileSize = []; % tiles (pixels) of the cross-correlation of the passes, e.g. 128 ([]: no coregistration, see coregistration_experiment.m)
+
+resultsDir = '/p/work1/cnieter/sar_images/3d_results';
+resultsFile = sprintf('%s/Results_3D_%d.mat',resultsDir,idxImage);
+% the whole solution as a sparse volume, so the points can be extracted
+% again at another threshold (readSparseVolume.m)
+volumeFile = sprintf('%s/Volume_3D_%d.mat',resultsDir,idxImage);
+% the height of every pixel from the tomography of the passes, for
+% screening before (or without) the sparse solve
+tomoFile = sprintf('%s/Tomo_3D_%d.mat',resultsDir,idxImage);
+
+% Skip the solve if an aperture with identical inputs and parameters was
+% already processed (see stageCache.m)
+[cacheFile,isCached,stageKey] = stageCache(sprintf('%s/stageCache',resultsDir),'recovery3d',struct(...
+    'im_final',{im_final},'xImage',xImage,'yImage',yImage,'f1',{f1},...
+    'azimuthVals',{azimuthVals},'elev1',{elev1},'snrReconstruction',snrReconstruction,...
+    'snrThreshold',snrThreshold,'shiftZ',shiftZ,'M',[numRangeBinsVoxel numRangeBinsVoxel numHeightBins],...
+    'D_z',D_z,'optTol',optTol,'nufftAccuracy',nufftAccuracy,'nufftMode',nufftMode,...
+    'multires',[multiresFactor multiresSupportDb multiresMargin],...
+    'debiasIterations',debiasIterations,'densityCompIterations',densityCompIterations,...
+    'paretoPoints',paretoPoints,'svrg',[svrgEpochs svrgBlocksPerPass],...
+    'volumeFloorDb',volumeFloorDb,'pointDetector',pointDetector,...
+    'cfar',[cfarPfa cfarGuard cfarTrain peakRadius],'tomoMethod',tomoMethod,...
+    'tomo',[tomoWindow tomoWarmStart],'coregPhaseModel',coregPhaseModel,...
+    'coregTileSize',coregTileSize));
+% (renamed when the volume gained the detected points, so no volume cached
+% before, without them, is restored)
+volumeCacheFile = strrep(cacheFile,'.mat','_pointVolume.mat');
+tomoCacheFile = strrep(cacheFile,'.mat','_tomo.mat');
+if isCached
+    copyfile(cacheFile,resultsFile);
+    if exist(volumeCacheFile,'file') == 2
+        copyfile(volumeCacheFile,volumeFile);
+    end
+    if exist(tomoCacheFile,'file') == 2
+        copyfile(tomoCacheFile,tomoFile);
+    end
+    return;
+end
 
 Res_x=D_x/numRangeBins; Res_y=D_y/numRangeBins;
 Res_xVoxel=D_x/M_x; Res_yVoxel=D_y/M_y; Res_z=D_z/M_z; 
@@ -45,15 +110,17 @@ yImageVoxel=(-M_y/2+1:M_y/2)*Res_yVoxel;
 
 zImage=(-M_z/2+1:M_z/2)*Res_z;
 
-[zGrid,~,~] = ndgrid(zImage,yImageVoxel,xImageVoxel);
-groups1=zeros(size(zGrid));
-
-for i=1:size(zGrid,1)
-    groups1(i,:,:) = reshape(single(1:M_x*M_y).',1,M_y,M_x);
+% The operator, the solvers and the extraction of the points all address
+% the voxels through this layout, so the volume is never permuted
+layout = voxelLayout([M_x M_y M_z],voxelOrder,voxelBlock);
+% one group per z-column, written plane by plane
+columnId = single(reshape(1:M_x*M_y,M_x,M_y));
+planeIdx = layout.offset{1} + layout.offset{2}.' + 1;
+groups = zeros(M_x*M_y*M_z,1,'single');
+for i=1:M_z
+    groups(planeIdx+layout.offset{3}(i)) = columnId;
 end
-groups = single(groups1(:));
-clear zGrid;
-clear groups1;
+clear columnId planeIdx;
 
 
 for i=1:numPasses
@@ -84,12 +151,34 @@ kz_grid=linspace(-1/2/Res_z, 1/2/Res_z, M_z+1); kz_grid(end)=[];
 k_x_total=[];
 k_y_total=[];
 k_z_total=[];
+rayStart=[];
+rayStep=[];
+rayLength=[];
+uniformFreq=true;
 phTotal=[];
 samplesIndexPass=1;
 for i=1:numPasses
     im_final{i} = im_final{i}...
         .*exp(-1i*2*pi*(phaseRampCenter_y*yGrid1+phaseRampCenter_x*xGrid1));
-    im_final{i} = im_final{i}.';
+    im_final{i}  = fliplr(flipud(im_final{i}.'));
+end
+
+% Subpixel shift and residual phase of every pass relative to the pass of
+% median elevation (coregisterPasses.m). The phase of a pass also holds
+% k_z times the mean height of the scene, so removing it refers the heights
+% to that mean instead of z = 0: the stage is off by default. They are applied while sampling
+% the phase history below: the shift as a phase ramp with the one of
+% shiftZ, the phase gradient as an offset of the knots of the 2D NUFFT.
+passShift = zeros(numPasses,2);
+passPhase = zeros(numPasses,1);
+passGradient = zeros(numPasses,2);
+if ~isempty(coregTileSize)
+    [~,referencePass] = min(abs(meanElev-median(meanElev)));
+    [passShift,passPhase,passGradient] = coregisterPasses(im_final,referencePass,...
+        struct('tileSize',coregTileSize,'phaseModel',coregPhaseModel));
+end
+
+for i=1:numPasses
     samplesIndexPass(i+1)=length(f1{i}(:,1))*length(azimuthVals{i});
     frep = f1{i};%repmat(f1{i},1,length(azimuthVals{i}));
     azrep = repmat(((azimuthVals{i})),length(f1{i}(:,1)),1);
@@ -108,10 +197,13 @@ for i=1:numPasses
     k_z=2/cspeed*(frep).*sind(elrep);
     k_z_c =phaseRampCenter_z;
     k_z=k_z(:) -k_z_c;
-    im_final{i}  = fliplr(flipud(im_final{i}));
-    [y,k1] = iFGG_2d_type2mod(im_final{i},[k_x k_y],12,kx_grid,ky_grid);
+    % shift (m) and phase gradient (cycles/m) of the pass
+    d = passShift(i,:).*[Res_x Res_y];
+    g = passGradient(i,:)./(2*pi*[Res_x Res_y]);
+    [y,k1] = iFGG_2d_type2mod(im_final{i},[k_x-g(1) k_y-g(2)],12,kx_grid,ky_grid);
     y=reshape(y,size(f1{i}));
-    y = exp(-1i*2*pi*reshape(k_z,size(f1{i}))*shiftZ).*y;
+    y = exp(-1i*2*pi*reshape(k_z*shiftZ + k_x*d(1) + k_y*d(2),size(f1{i}))...
+        -1i*(passPhase(i) - 2*pi*g*d.')).*y;
     y=y(:);
     y=y/norm(y);
     phTotal=[phTotal;y];
@@ -122,6 +214,16 @@ for i=1:numPasses
     k_y_1{i} = k_y;
     k_z_1{i} = k_z;
     
+    % Each pulse is a ray through the k-space origin sampled at equally
+    % spaced frequencies, which the NUFFT plan can exploit
+    dirRay = 2/cspeed*[cosd(azimuthVals{i}(:)).*cosd(elev1{i}(:)),...
+        sind(azimuthVals{i}(:)).*cosd(elev1{i}(:)), sind(elev1{i}(:))];
+    deltaF = f1{i}(2,:)-f1{i}(1,:);
+    uniformFreq = uniformFreq && ...
+        max(max(abs(diff(f1{i},2,1)))) <= 1e-6*min(abs(deltaF));
+    rayStart=[rayStart; f1{i}(1,:).'.*dirRay-[k_x_c k_y_c k_z_c]];
+    rayStep=[rayStep; deltaF.'.*dirRay];
+    rayLength=[rayLength; size(f1{i},1)*ones(size(f1{i},2),1)];
 end
 clear azrep;
 clear elrep;
@@ -130,6 +232,35 @@ clear k_x;
 clear k_y;
 clear k_z;
 clear data_pass;
+clear d g;
+
+%% Per-pixel tomography: the passes sample every z-column at the vertical
+% wavenumbers of their mean elevations (relative to the reference of the
+% phase history, the common phase does not change the spectra)
+if ~strcmp(tomoMethod,'none')
+    kzPass = 2*meanF.*sind(meanElev)/cspeed - phaseRampCenter_z;
+    tomoImages = cell(size(im_final));
+    for i=1:numPasses
+        tomoImages{i} = applyCoregistration(im_final{i},passShift(i,:),passPhase(i),passGradient(i,:));
+        tomoImages{i} = tomoImages{i}/norm(tomoImages{i}(:));
+    end
+    tic;
+    [tomoZ,tomoValue,tomoPower] = tomoHeightEstimate(tomoImages,kzPass,zImage+shiftZ,...
+        struct('method',tomoMethod,'window',tomoWindow));
+    fprintf('Tomography (%s): %d pixels in %.1f seconds\n',tomoMethod,numel(tomoZ),toc);
+    clear tomoImages;
+    % the peak of every pixel within snrThreshold dB of the strongest one
+    xImagePixel = (-size(tomoZ,1)/2+1:size(tomoZ,1)/2)*Res_x;
+    yImagePixel = (-size(tomoZ,2)/2+1:size(tomoZ,2)/2)*Res_y;
+    tomoKept = find(tomoPower > max(tomoPower(:))*10^(-snrThreshold/10));
+    [tomoX,tomoY] = ind2sub(size(tomoZ),tomoKept);
+    tomo_points = [xImagePixel(tomoX); yImagePixel(tomoY); shiftZ + zImage(tomoZ(tomoKept))];
+    tomo_amps = 10*log10(tomoPower(tomoKept));
+    save(tomoFile,'tomo_points','tomo_amps','tomoMethod','tomoWindow','azCenter','-v7.3');
+    copyfile(tomoFile,tomoCacheFile);
+    clear tomo_points tomo_amps xImagePixel yImagePixel;
+end
+
 %% Solving the regularized image-reconstruction for all the passes jointly as a 3D problem
 samplesIndexPass=cumsum(samplesIndexPass)-1;
 samplesIndexPass(1)=0;
@@ -138,38 +269,145 @@ phTotal=numPasses*phTotal/norm(phTotal);
 
 sigma_n = numPasses*10^(-snrReconstruction/10);
 
-A1=@(x,mode)sar_operator_nufft_3d(x,mode,k_x_total,k_y_total,k_z_total,...
-    kx_grid_voxel,ky_grid_voxel,kz_grid,M_x,M_y,M_z);
-
-options = spgSetParms('isComplex',1,'verbosity',1,'optTol',7e-3);
-X2=  spg_group(A1,phTotal,groups, sigma_n, options );
-clear groups;
-
-[zGrid,yGrid,xGrid] = ndgrid(zImage,yImageVoxel,xImageVoxel);
-p_x=[];
-p_y=[];
-p_z=[];
-c_1=[];
-
-%% Performing the 3D reconstruction by reshaping the obtained result
-xx = reshape(X2,M_z,M_y,M_x);
-xx= permute(xx,[1,3,2]);
- 
-
-
-[aa,bb,cc]=ind2sub(size(xx),find(20*log10(abs(xx)) > max(20*log10(abs(xx(:)))) - snrThreshold));
-sc_points_layOver(1,:) = arrayfun(@(i)xGrid(aa(i),bb(i),cc(i)),(1:length(aa)).');
-sc_points_layOver(2,:) = arrayfun(@(i)yGrid(aa(i),bb(i),cc(i)),(1:length(aa)).');
-sc_points_layOver(3,:)=  shiftZ + arrayfun(@(i)zGrid(aa(i),bb(i),cc(i)),(1:length(aa)).');
+% The knots are fixed for the whole solve, so the NUFFT plan (gridding
+% indices and Gaussian factors of every knot) is built once and reused by
+% every application of the operator. When every pulse has a uniform
+% frequency axis the plan only keeps the rays and walks along them.
+if uniformFreq
+    nufftKnots = struct('start',rayStart,'step',rayStep,'length',rayLength);
+else
+    nufftKnots = [k_x_total k_y_total k_z_total];
+end
+FGG_Plan3D('threading',nufftThreads,nufftHugePages,nufftPinning);
+nufftPlan = FGG_3d_plan(nufftKnots,[M_x M_y M_z],...
+    nufftAccuracy,kx_grid_voxel,ky_grid_voxel,kz_grid,nufftMode);
+A1=@(x,mode)sar_operator_nufft_3d_plan(x,mode,nufftPlan,layout);
+% A1=@(x,mode)sar_operator_nufft_3d(x,mode,k_x_total,k_y_total,k_z_total,...
+%     kx_grid_voxel,ky_grid_voxel,kz_grid,M_x,M_y,M_z);
+% Weight the residual with the density compensation of the knots, sqrt(w),
+% so the densely sampled frequencies and azimuths of the passes do not
+% dominate it (sar_operator_weighted.m). This changes the fidelity term, so
+% sigma_n is rescaled to keep its ratio to the norm of the weighted data.
+if densityCompIterations > 0
+    sqrtW = sqrt(FGG_3d_densityComp(nufftPlan,densityCompIterations));
+    sigma_n = sigma_n*norm(sqrtW.*phTotal)/norm(phTotal);
+else
+    sqrtW = 1;
+end
+A1w=@(x,mode)sar_operator_weighted(x,mode,A1,sqrtW);
 
-amps= 20*log10(abs(arrayfun(@(i)xx(aa(i),bb(i),cc(i)),(1:length(aa)).')));
+if paretoPoints > 0
+    % several points of the Pareto curve per step, solved together
+    options = struct('paretoPoints',paretoPoints,'optTol',optTol);
+else
+    options = spgSetParms('isComplex',1,'verbosity',1,'optTol',optTol);
+end
+if multiresFactor > 1
+    X2 = coarseToFineRecovery_3D(A1w,sqrtW.*phTotal,groups,sigma_n,options,nufftKnots,...
+        [M_x M_y M_z],nufftAccuracy,nufftMode,{kx_grid_voxel,ky_grid_voxel,kz_grid},...
+        multiresFactor,multiresSupportDb,multiresMargin,sqrtW,layout);
+else
+    x0 = [];
+    if svrgEpochs > 0
+        % one NUFFT plan per block of consecutive pulses of a pass, whose
+        % measurements are the rows of its rays
+        rayEnd = cumsum(rayLength);
+        passRays = cumsum([0 cellfun(@(f)size(f,2),f1(:).')]);
+        numBlocks = numPasses*svrgBlocksPerPass;
+        blockPlans = cell(1,numBlocks);
+        blockOperators = cell(1,numBlocks);
+        blockRows = cell(1,numBlocks);
+        for i=1:numPasses
+            blockEdges = round(linspace(passRays(i),passRays(i+1),svrgBlocksPerPass+1));
+            for j=1:svrgBlocksPerPass
+                q = (i-1)*svrgBlocksPerPass+j;
+                rays = blockEdges(j)+1:blockEdges(j+1);
+                blockRows{q} = (rayEnd(rays(1))-rayLength(rays(1))+1:rayEnd(rays(end))).';
+                if uniformFreq
+                    blockKnots = struct('start',rayStart(rays,:),'step',rayStep(rays,:),...
+                        'length',rayLength(rays));
+                else
+                    blockKnots = nufftKnots(blockRows{q},:);
+                end
+                blockPlans{q} = FGG_3d_plan(blockKnots,[M_x M_y M_z],...
+                    nufftAccuracy,kx_grid_voxel,ky_grid_voxel,kz_grid,nufftMode);
+                if isscalar(sqrtW)
+                    blockWeights = sqrtW;
+                else
+                    blockWeights = sqrtW(blockRows{q});
+                end
+                % each plan divides by its own number of knots: rescale it
+                % to the rows of A1, so the A_p'*A_p sum to A1'*A1
+                blockScale = numel(blockRows{q})/numel(phTotal);
+                blockOperators{q} = @(x,mode)blockScale*sar_operator_weighted(x,mode,...
+                    @(v,m)sar_operator_nufft_3d_plan(v,m,blockPlans{q},layout),blockWeights);
+            end
+        end
+        x0 = svrgGroupRecovery(A1w,sqrtW.*phTotal,groups,sigma_n,...
+            blockOperators,blockRows,svrgEpochs);
+        cellfun(@FGG_3d_planDestroy,blockPlans);
+        clear blockOperators blockPlans blockRows blockKnots blockScale;
+    elseif tomoWarmStart && exist('tomoZ','var')
+        % the tomographic peak of every kept pixel at the nearest voxel,
+        % scaled by least squares to the data
+        x0 = zeros(M_x*M_y*M_z,1);
+        x0(voxelLayoutIndex(layout,round((tomoX-1)*M_x/size(tomoZ,1))+1,...
+            round((tomoY-1)*M_y/size(tomoZ,2))+1,tomoZ(tomoKept))) = tomoValue(tomoKept);
+        Ax0 = A1w(x0,1);
+        x0 = x0*((Ax0'*(sqrtW.*phTotal))/(Ax0'*Ax0));
+        clear Ax0;
+    end
+    % full-data solve, started at the SVRG or tomographic result if there
+    % is one
+    if paretoPoints > 0
+        X2 = spgGroupPareto(A1w,sqrtW.*phTotal,groups,sigma_n,options,x0);
+    elseif ~isempty(x0)
+        options = spgGroupOptions(options,groups);
+        X2 = spgl1(A1w,sqrtW.*phTotal,options.primal_norm(x0,1),sigma_n,x0,options);
+    else
+        X2=  spg_group(A1w,sqrtW.*phTotal,groups, sigma_n, options );
+    end
+    clear x0;
+end
+clear groups nufftKnots sqrtW rayStart rayStep;
+clear tomoZ tomoValue tomoPower tomoKept tomoX tomoY;
+
+%% Performing the 3D reconstruction from the detected voxels, located
+% through the layout of the solution
+if strcmp(pointDetector,'cfar')
+    % column peaks that stand out of their neighbourhood, down to
+    % snrThreshold dB below the maximum
+    kept = detectPoints3D(X2,layout,struct('floorDb',snrThreshold,'pfa',cfarPfa,...
+        'guard',cfarGuard,'train',cfarTrain,'peakRadius',peakRadius));
+else
+    kept = find(abs(X2) > max(abs(X2))*10^(-snrThreshold/20));
+end
+% Remove the shrinkage of the amplitudes of the detected points
+if debiasIterations > 0
+    keptValues = debiasRecovery_3D(X2,phTotal,nufftPlan,[k_x_total k_y_total k_z_total],...
+        [Res_xVoxel Res_yVoxel Res_z],kept,debiasIterations,layout);
+else
+    keptValues = X2(kept);
+end
+FGG_3d_planDestroy(nufftPlan);
+% The volume holds the solver output and the detected points with their
+% debiased values, so it can be thresholded either way
+writeSparseVolume(volumeFile,X2,[M_z M_x M_y],zImage+shiftZ,xImageVoxel,yImageVoxel,...
+    volumeFloorDb,layout,kept,keptValues);
+copyfile(volumeFile,volumeCacheFile);
+[ix,iy,iz] = voxelLayoutSubscripts(layout,kept);
+sc_points_layOver = [xImageVoxel(ix); yImageVoxel(iy); shiftZ + zImage(iz)];
+
+amps= 20*log10(abs(keptValues));
+clear kept keptValues ix iy iz;
 viewAngle = azCenter;
 
 % figure; scatter3(sc_points_layOver(1,:) ,sc_points_layOver(2,:),...
 %     sc_points_layOver(3,:),40,((amps)),'filled');
 % colormap(flipud(SAR_cmap)); colorbar;
 
-save(sprintf('/p/work1/cnieter/sar_images/3d_results/Results_3D_%d',idxImage),'fixedElev','fixedCenterFreq',...
-    'meanElev','meanF','azCenter','amps','sc_points_layOver','viewAngle','-v7.3');
+save(resultsFile,'fixedElev','fixedCenterFreq',...
+    'meanElev','meanF','azCenter','amps','sc_points_layOver','viewAngle','stageKey','-v7.3');
+copyfile(resultsFile,cacheFile);
 
 end
@@ -0,0 +1,133 @@
+function  plan = FGG_3d_autotune(knots,N,accuracy,GridListx,GridListy,GridListz,cacheDir)
+%Description:
+%Creates the fastest 3D NUFFT plan (FGG_3d_plan.m) that meets the
+%requested accuracy on this machine. Instead of applying R = 2 and
+%M_sp = accuracy blindly, candidate configurations are timed on short
+%trial runs of FGG_3d_type1plan.m and iFGG_3d_type2plan.m (gridding, FFT
+%and deconvolution, as applied by the solver):
+%   1. the oversampling R (1.5, 2 or 3, with the kernel length M_sp that
+%      keeps the error of FGG_3d_plan.m's error model), since a larger
+%      grid makes the FFT slower but the kernel shorter,
+%   2. for the fastest R, the evaluation of the Gaussian (recurrence or
+%      table) and the storage of the gridding (on the fly, separable
+%      weights or sparse matrix).
+%Candidates whose rounding (float weights, linear table) exceeds the
+%error of the requested accuracy are skipped. The choice is stored in a
+%tuning cache (stageCache.m) keyed by the grid shape, the number and
+%structure of the knots, the accuracy, the number of threads and the CPU
+%model, so later plans of the same shape on the same machine skip the
+%trials. The thread count and pinning stay the explicit
+%FGG_Plan3D('threading',...) setting, and the z slabs of the gridding
+%follow it.
+%
+%Inputs:
+%       knots, N, accuracy, GridListx, GridListy, GridListz: as in
+%           FGG_3d_plan.m
+%       cacheDir: (optional) folder of the tuning cache (default:
+%           FGG_tuning in the Matlab preferences folder)
+%Outputs:
+%       plan: the plan of the chosen configuration, with the additional
+%           field config (R, kernel, mode, weightClass and the time of one
+%           type-I plus type-II transform in seconds).
+%           Release it with FGG_3d_planDestroy(plan).
+
+if nargin<3, accuracy=6; end
+if nargin<7, cacheDir=fullfile(prefdir,'FGG_tuning'); end
+accuracy=accuracy(:).'.*ones(1,3);
+
+if isstruct(knots) && numel(knots.length)==1
+    M=knots.length*size(knots.start,1);
+elseif isstruct(knots)
+    M=sum(knots.length);
+else
+    M=size(knots,1);
+end
+%Error of the untuned plan (R = 2, M_sp = accuracy), see FGG_3d_plan.m
+target=sum(exp(-pi*accuracy/1.5));
+
+[cacheFile,isCached] = stageCache(cacheDir,'nufftTuning',struct('N',N(:).',...
+    'M',M,'rays',isstruct(knots),'accuracy',accuracy,...
+    'threads',maxNumCompThreads,'cpu',cpuModel()));
+if isCached
+    cached=load(cacheFile,'config');
+    config=cached.config;
+    plan=makePlan(config);
+    plan.config=config;
+    return;
+end
+
+f=randn(M,1)+sqrt(-1)*randn(M,1);
+F=randn(N)+sqrt(-1)*randn(N);
+
+%1. Oversampling, with the default gridding
+best=[];
+for R=[1.5 2 3]
+    best=trial(struct('R',R,'kernel','recurrence','mode','onthefly',...
+        'weightClass','double'),best);
+end
+%2. Gaussian and storage of the gridding for the chosen R. The floor is
+%the rounding error of the candidate (float weights carry about 7 digits,
+%the linear table about 6.5)
+candidates={'cubic','onthefly','double',1e-12;...
+    'linear','onthefly','double',3e-7;...
+    'recurrence','separable','double',0;...
+    'recurrence','separable','single',1e-7;...
+    'cubic','separable','single',1e-7;...
+    'recurrence','matrix','double',1e-7};
+for c=1:size(candidates,1)
+    if candidates{c,4}<=target
+        best=trial(struct('R',best.config.R,'kernel',candidates{c,1},...
+            'mode',candidates{c,2},'weightClass',candidates{c,3}),best);
+    end
+end
+
+config=best.config;
+save(cacheFile,'config');
+plan=best;
+disp(['FGG_3d_autotune: R = ',num2str(config.R),', ',config.kernel,' kernel, ',...
+    config.mode,' (',config.weightClass,'), ',num2str(config.seconds),' seconds per transform pair'])
+
+    %Times one candidate and keeps the faster of it and best
+    function best=trial(config,best)
+        candidatePlan=makePlan(config);
+        if strcmp(config.mode,'matrix') && ~candidatePlan.isMatrix
+            FGG_3d_planDestroy(candidatePlan);
+            return;
+        end
+        config.seconds=inf;
+        for rep=1:3
+            tic
+            FGG_3d_type1plan(f,candidatePlan);
+            iFGG_3d_type2plan(F,candidatePlan);
+            config.seconds=min(config.seconds,toc);
+        end
+        candidatePlan.config=config;
+        if isempty(best) || config.seconds<best.config.seconds
+            if ~isempty(best), FGG_3d_planDestroy(best); end
+            best=candidatePlan;
+        else
+            FGG_3d_planDestroy(candidatePlan);
+        end
+    end
+
+    function plan=makePlan(config)
+        mode=config.mode;
+        if strcmp(mode,'matrix'), mode='auto'; end
+        plan=FGG_3d_plan(knots,N,accuracy,GridListx,GridListy,GridListz,...
+            mode,config.weightClass,config.kernel,config.R);
+    end
+end
+
+%Name of the CPU, part of the key of the tuning cache
+function name=cpuModel()
+name=getenv('PROCESSOR_IDENTIFIER');%Windows
+if isempty(name) && exist('/proc/cpuinfo','file')
+    info=fileread('/proc/cpuinfo');
+    name=regexp(info,'model name\s*:\s*([^\n]*)','tokens','once');
+    if ~isempty(name), name=name{1}; end
+end
+if isempty(name) && ismac
+    [~,name]=system('sysctl -n machdep.cpu.brand_string');
+end
+name=strtrim(char(name));
+end
@@ -0,0 +1,28 @@
+function  w = FGG_3d_densityComp(plan,numIter)
+%Description:
+%Density-compensation weights of the knots of a plan from FGG_3d_plan.m,
+%computed with the iterative method of Pipe and Menon [1]:
+%    w <- w ./ (C*w),
+%where C*w spreads the weights onto the oversampled grid with the Gaussian
+%of the plan and interpolates the grid back at the knots (the 'type1' and
+%'type2' gridding of FGG_Plan3D, without FFTs). At the fixed point the
+%gridded weights are flat, so a knot in a densely sampled region of
+%k-space gets a small weight and an isolated knot a large one. The
+%weights are normalized to mean 1.
+%
+%Inputs:
+%       plan: the plan returned by FGG_3d_plan.m
+%       numIter: (optional) number of iterations (default 10)
+%Outputs:
+%       w: real positive weights of the knots (Mx1)
+%
+%[1] J. G. Pipe and P. Menon, "Sampling density compensation in MRI:
+% rationale and an iterative numerical solution," Magn. Reson. Med., 1999.
+
+if nargin<2, numIter=10; end
+w=ones(plan.M,1);
+for iter=1:numIter
+    grid=FGG_Plan3D('type1',plan.handle,w);
+    w=w./max(real(FGG_Plan3D('type2',plan.handle,grid)),realmin);
+end
+w=w/mean(w);
@@ -0,0 +1,157 @@
+function  plan = FGG_3d_plan(knots,N,accuracy,GridListx,GridListy,GridListz,mode,weightClass,kernel,R)
+%Description:
+%Creates a persistent plan for repeated 3D Gaussian-gridding NUFFTs with
+%fixed knots (see FGG_3d_type1mod.m and iFGG_3d_type2mod.m for the
+%algorithm). Everything that only depends on the knots is computed once in
+%the MEX function FGG_Plan3D, which keeps it in memory between calls, so
+%FGG_3d_type1plan.m and iFGG_3d_type2plan.m only do the gridding, the FFT
+%and the deconvolution.
+%
+%Inputs:
+%       knots: the Mx3 k-space locations of the data (not yet scaled),
+%           as given to FGG_3d_type1mod.m, or, when the knots lie on rays
+%           with equally spaced samples (one ray per pulse in polar-format
+%           SAR), a struct with the fields
+%           start: Px3 first knot of every ray
+%           step: Px3 increment between consecutive knots of every ray
+%           length: number of knots of every ray (Px1, or a scalar)
+%           The knots are then numbered ray after ray, i.e. knot j of ray p
+%           is start(p,:)+(j-1)*step(p,:), and the Gaussian factors are
+%           computed by recurrence along the rays instead of stored.
+%       N = [Nx,Ny,Nz]: the size of the spatial grid in the image domain
+%           (even lengths)
+%       accuracy: a positive integer indicating the desired number of
+%           digits of accuracy (M_sp), or one per axis [x y z] for a
+%           shorter kernel along the axes that need fewer digits; the
+%           footprint of a knot is then 2*M_sp(1) x 2*M_sp(2) x 2*M_sp(3)
+%       GridListx, GridListy, GridListz: the frequency grid onto which the
+%           data should be interpolated, as in FGG_3d_type1mod.m
+%       mode: (optional) 'matrix' to store the gridding as a sparse matrix
+%           (float weights) so that every transform is a multithreaded
+%           sparse matrix-vector product, 'onthefly' to compute the
+%           weights at every transform, or 'auto' (default) to use the
+%           matrix when it fits in half of the free memory and
+%           accuracy <= 7, or 'separable' to store the three 1D Gaussian
+%           weight vectors of every knot (2*sum(M_sp) values per knot)
+%           or 'tune' to time the candidate configurations on this
+%           machine and keep the fastest (FGG_3d_autotune.m; the
+%           remaining inputs are then chosen by the tuner)
+%       weightClass: (optional) precision of the separable weights,
+%           'double' (default), 'single', 'bfloat16' or 'half'
+%       kernel: (optional) evaluation of the Gaussian, 'recurrence'
+%           (default, the E_2 power chain of FGG_Convolution3D.c), or a
+%           table read with 'linear' (about 7 digits) or 'cubic' (about 12
+%           digits) interpolation
+%       R: (optional) oversampling factor of the grid, scalar or one per
+%           axis (default 2). A larger R needs a shorter kernel for the
+%           same accuracy, at the cost of a larger FFT
+%Outputs:
+%       plan: struct with the plan handle and the constants of the
+%           deconvolution; plan.isMatrix tells which mode was chosen and
+%           plan.errorEstimate is the expected relative error of the
+%           gridding (see below).
+%           Release it with FGG_3d_planDestroy(plan).
+%
+%Usage Notes:
+%In order for this function to work, the C file "FGG_Plan3D.c" must be
+%compiled into a Matlab executable (cmex) with the interleaved-complex API:
+%
+%mex -R2018a FGG_Plan3D.c
+%
+%See FGG_3d_type1mod.m for the effect of M_sp on the accuracy and for the
+%references. With tau chosen as below, the aliasing and the truncation
+%errors of axis d are both about
+%    exp(-pi*M_sp(d)*(R(d)-1)/(R(d)-1/2))
+%(3.5e-6 for M_sp = 6 and R = 2), and since the kernel is a product over
+%the axes the errors of the three axes add up. M_sp(d) is chosen so that
+%an axis with R(d) = 2 has M_sp(d) = accuracy(d), as in FGG_3d_type1mod.m,
+%and a larger R(d) gives the same error with a shorter kernel.
+
+if nargin<3, accuracy=6; end
+if nargin<7, mode='auto'; end
+if nargin<8, weightClass='double'; end
+if nargin<9, kernel='recurrence'; end
+if nargin<10, R=2; end
+if strcmp(mode,'tune')
+    plan = FGG_3d_autotune(knots,N,accuracy,GridListx,GridListy,GridListz);
+    return;
+end
+kernelId = find(strcmp(kernel,{'recurrence','linear','cubic'}))-1;
+if isempty(kernelId)
+    error('FGG_3d_plan:kernel','Unknown kernel ''%s''.',kernel);
+end
+N=N(:).';
+Nx=N(1); Ny=N(2); Nz=N(3);
+if isstruct(knots) && numel(knots.length)==1
+    M=knots.length*size(knots.start,1);
+elseif isstruct(knots)
+    M=sum(knots.length);
+else
+    M=size(knots,1);
+end
+R=R(:).'.*ones(1,3);
+accuracy=accuracy(:).'.*ones(1,3);
+%M_sp is the length of the convolution kernel along every axis
+M_sp=ceil(accuracy.*(R-.5)./(1.5*(R-1))-1e-9);
+tau = (pi*M_sp./(N.*N.*R.*(R-.5)));%Suggested value of tau by Greengard [1]
+%The length of the oversampled grid (even, so the image is centered in it)
+M_r = 2*round(R.*N/2);
+
+%Scale the knots onto the user-defined grid and shift them to [0,2*pi)
+%(same mapping as FGG_3d_type1mod.m)
+scale = -N/2./([min(GridListx) min(GridListy) min(GridListz)] );
+if isstruct(knots)
+    %The rays may leave [0,2*pi), the MEX function wraps them on the grid
+    rayStart=mod(2*pi*(knots.start.*scale)./N,2*pi);
+    rayStep=2*pi*(knots.step.*scale)./N;
+else
+    knots=mod(2*pi*(knots.*scale)./N,2*pi);
+end
+
+%Precompute E_3, the constant component of the (truncated) Gaussian:
+%(2*M_sp(d) values per axis, which sets the kernel length in FGG_Plan3D)
+E_3x(1,1:M_sp(1)) = exp(-((pi*(1:M_sp(1))/M_r(1)).^2)/tau(1));
+E_3x=[fliplr(E_3x(1:(M_sp(1)-1))),1,E_3x];
+E_3y(1,1:M_sp(2)) = exp(-((pi*(1:M_sp(2))/M_r(2)).^2)/tau(2));
+E_3y=[fliplr(E_3y(1:(M_sp(2)-1))),1,E_3y];
+E_3z(1,1:M_sp(3)) = exp(-((pi*(1:M_sp(3))/M_r(3)).^2)/tau(3));
+E_3z=[fliplr(E_3z(1:(M_sp(3)-1))),1,E_3z];
+
+if isstruct(knots)
+    plan.handle = FGG_Plan3D('createrays',double(rayStart),double(rayStep),...
+        double(knots.length(:)),E_3x,E_3y,E_3z,...
+        [max(M_sp), tau(1), tau(2), tau(3), M_r(1), M_r(2), M_r(3), kernelId]);
+else
+    plan.handle = FGG_Plan3D('create',double(knots),E_3x,E_3y,E_3z,...
+        [max(M_sp), tau(1), tau(2), tau(3), M_r(1), M_r(2), M_r(3), kernelId]);
+end
+switch mode
+    case 'auto'
+        plan.isMatrix = FGG_Plan3D('materialize',plan.handle);
+    case 'matrix'
+        plan.isMatrix = FGG_Plan3D('materialize',plan.handle,inf);
+    case 'onthefly'
+        plan.isMatrix = false;
+    case 'separable'
+        FGG_Plan3D('separable',plan.handle,weightClass);
+        plan.isMatrix = false;
+    otherwise
+        FGG_Plan3D('destroy',plan.handle);
+        error('FGG_3d_plan:mode','Unknown mode ''%s''.',mode);
+end
+plan.N = N;
+plan.M = M;
+plan.R = R;
+plan.M_sp = M_sp;
+plan.tau = tau;
+plan.M_r = M_r;
+%Error model of the gridding: the relative errors of the three axes add
+plan.errorEstimate = sum(exp(-pi*M_sp.*(R-1)./(R-.5)));
+%Offset of the image inside the oversampled grid
+plan.offset = (M_r-N)/2;
+%E_4, the Hadamard inverse of the Fourier Transform of the truncated
+%Gaussian, one vector per dimension so that the deconvolution is applied
+%by implicit expansion without forming the full [Nx,Ny,Nz] matrix
+plan.E_4x = sqrt(pi/tau(1))*exp(tau(1)*(((-Nx/2):(Nx/2-1)).'.^2));
+plan.E_4y = sqrt(pi/tau(2))*exp(tau(2)*(((-Ny/2):(Ny/2-1)).^2));
+plan.E_4z = reshape(sqrt(pi/tau(3))*exp(tau(3)*(((-Nz/2):(Nz/2-1)).^2)),1,1,Nz);
@@ -0,0 +1,12 @@
+function FGG_3d_planDestroy(plan)
+%Description:
+%Releases the memory held by a plan from FGG_3d_plan.m or
+%FGG_3d_type3plan.m. All plans are also released when the MEX function is
+%cleared (clear mex).
+
+if isfield(plan,'spreadHandle')
+    FGG_Plan3D('destroy',plan.spreadHandle);
+    FGG_Plan3D('destroy',plan.kPlan.handle);
+else
+    FGG_Plan3D('destroy',plan.handle);
+end
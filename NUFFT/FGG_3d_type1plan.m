@@ -0,0 +1,42 @@
+function  F = FGG_3d_type1plan(f,plan,layout)
+%Description:
+%Type-I (nonuniform --> uniform) 3D NUFFT with a plan from FGG_3d_plan.m.
+%Same result as FGG_3d_type1mod(f,knots,N,accuracy,GridListx,GridListy,
+%GridListz) for the knots, N and grid of the plan.
+%
+%Inputs:
+%       f: frequency-domain data (a complex Mx1 vector), or K such
+%           vectors as the columns of an MxK matrix, which are gridded
+%           concurrently (FGG_Plan3D splits its threads between them)
+%       plan: the plan returned by FGG_3d_plan.m
+%       layout: (optional) voxel layout from voxelLayout.m; the MEX
+%           function then crops and deconvolves the image straight into
+%           that order ('crop'), without any reshape or permute
+%Outputs:
+%       F: the 3D NUFFT (approximate DFT) of f, with dimension [Nx,Ny,Nz]
+%           (or [Nx,Ny,Nz,K]), or a prod(N)xK matrix in the order of
+%           layout.
+
+N=plan.N;
+%Gridding: the MEX function returns the complex oversampled grid directly
+K=size(f,2);
+f_tau = reshape(FGG_Plan3D('type1',plan.handle,f),[plan.M_r K]);
+if K==1
+    F_tau=fftshift(fftn(ifftshift(f_tau)));
+else
+    %3D FFT of every column (fftn would also transform across them)
+    F_tau=f_tau;
+    for d=1:3
+        F_tau=fftshift(fft(ifftshift(F_tau,d),[],d),d);
+    end
+end
+clear f_tau;
+if nargin > 2
+    F = FGG_Plan3D('crop',F_tau,[plan.M_r plan.offset N],plan.E_4x,plan.E_4y,plan.E_4z,...
+        1/(plan.M*prod(plan.M_r./N)),layout.offset{:});
+    return;
+end
+%Crop the image out of the oversampled grid and deconvolve
+F = F_tau(plan.offset(1)+(1:N(1)),plan.offset(2)+(1:N(2)),plan.offset(3)+(1:N(3)),:);
+clear F_tau;
+F = F.*plan.E_4x.*plan.E_4y.*plan.E_4z/(plan.M*prod(plan.M_r./N));
@@ -0,0 +1,17 @@
+function  F = FGG_3d_type3(f,plan)
+%Description:
+%Type-3 3D NUFFT from the k-space knots to the target points of a plan from
+%FGG_3d_type3plan.m,
+%    F(k) = 1/M sum_j f(j) exp(-i*2*pi*knots(j,:)*targets(k,:).'),
+%computed as the exact adjoint of iFGG_3d_type3.m.
+%
+%Inputs:
+%       f: frequency-domain data at the knots (complex Mx1)
+%       plan: the plan returned by FGG_3d_type3plan.m
+%Outputs:
+%       F: the values at the targets (complex Kx1)
+
+%Adjoint of the type-2 NUFFT (see sar_operator_nufft_3d_plan.m)
+G=FGG_3d_type1plan(conj(plan.post).*f(:),plan.kPlan)/prod(plan.Ng);
+%Adjoint of the spreading: interpolation of the inner grid at the targets
+F=conj(plan.pre).*FGG_Plan3D('type2',plan.spreadHandle,G);
@@ -0,0 +1,86 @@
+function  plan = FGG_3d_type3plan(knots,targets,accuracy)
+%Description:
+%Creates a plan for the 3D type-3 (nonuniform to nonuniform) NUFFT between
+%the k-space knots of the data and an arbitrary list of points in space,
+%    F(k) = 1/M sum_j f(j) exp(-i*2*pi*knots(j,:)*targets(k,:).')
+%(FGG_3d_type3.m) and its adjoint
+%    f(j) = 1/M sum_k F(k) exp(i*2*pi*knots(j,:)*targets(k,:).')
+%(iFGG_3d_type3.m). With the targets on the voxel grid this is the grid
+%operator of sar_operator_nufft_3d_plan.m restricted to those voxels (same
+%1/M scaling), so amplitudes, residuals and refinements can be evaluated
+%on a sparse voxel list.
+%
+%The type-3 transform is built on the Gaussian gridding of [1], following
+%[2]: the targets are spread with a Gaussian onto a uniform grid covering
+%their bounding box (FGG_Plan3D), that grid is taken to the knots with the
+%type-2 NUFFT (iFGG_3d_type2plan.m), and the Gaussian is divided out at
+%every knot. Both problems are centered first, so the inner grid only
+%depends on the product of the extent of the targets and the extent of
+%the knots, not on their position. Per axis, with X and K the half-widths
+%of the targets and of the knots,
+%    grid spacing h = 1/(4K), Gaussian exp(-x^2/(4tau)),
+%    tau = M_sp/(32*sqrt(2)*pi*K^2), grid size about 8XK+2M_sp,
+%which balances the aliasing and truncation errors at exp(-pi*M_sp/sqrt(2)).
+%
+%Inputs:
+%       knots: Mx3 k-space locations of the data (cycles per meter, e.g.
+%           [k_x_total k_y_total k_z_total] of JointSparseRecovery_3D.m)
+%       targets: Kx3 points in space (meters), in the frame where voxel
+%           (i1,i2,i3) of the grid operator sits at ((i-1-N/2).*Res)
+%       accuracy: (optional) a positive integer indicating the desired
+%           number of digits of accuracy (M_sp, default 6)
+%Outputs:
+%       plan: struct with the handles and the phase/deconvolution factors.
+%           Release it with FGG_3d_planDestroy(plan).
+%
+%Usage Notes:
+%The C file "FGG_Plan3D.c" must be compiled (see FGG_3d_plan.m).
+%
+%[1] L. Greengard and J.-Y. Lee, "Accelerating the Nonuniform Fast Fourier
+% Transform," SIAM Review, 2004.
+%[2] J.-Y. Lee and L. Greengard, "The type 3 nonuniform FFT and its
+% applications," J. Comput. Phys., 2005.
+
+if nargin<3, accuracy=6; end
+M_sp=accuracy;
+M=size(knots,1);
+
+%Center both point sets
+r_c=(max(targets,[],1)+min(targets,[],1))/2;
+k_c=(max(knots,[],1)+min(knots,[],1))/2;
+X=max(abs(targets-r_c),[],1);
+K=max(max(abs(knots-k_c),[],1),eps);
+
+%Inner uniform grid in space, one Gaussian per axis
+h=1./(4*K);
+tau=M_sp./(32*sqrt(2)*pi*K.^2);
+Ng=2*ceil((2*X./h+2*M_sp+2)/2);
+L=Ng.*h;
+
+%Spreading of the targets with FGG_Plan3D: on the circle of length 2*pi the
+%grid spacing is 2*pi/Ng and the Gaussian factor is tau*(2*pi/L)^2
+tau_c=tau.*(2*pi./L).^2;
+theta=mod(2*pi*(targets-r_c)./L,2*pi);
+E_3=cell(1,3);
+for d=1:3
+    E_3d(1,1:M_sp) = exp(-((pi*(1:M_sp)/Ng(d)).^2)/tau_c(d));
+    E_3{d}=[fliplr(E_3d(1:(M_sp-1))),1,E_3d];
+end
+plan.spreadHandle=FGG_Plan3D('create',double(theta),E_3{1},E_3{2},E_3{3},...
+    [M_sp, tau_c(1), tau_c(2), tau_c(3), Ng(1), Ng(2), Ng(3)]);
+
+%Type-2 NUFFT from the inner grid to the centered knots
+plan.kPlan=FGG_3d_plan(knots-k_c,Ng,accuracy,[-1 1]/(2*h(1)),...
+    [-1 1]/(2*h(2)),[-1 1]/(2*h(3)),'onthefly');
+
+%exp(i*2*pi*k.r) = exp(i*2*pi*k_c.r) exp(i*2*pi*(k-k_c).r_c)
+%exp(i*2*pi*(k-k_c).(r-r_c)), and the Fourier transform of the Gaussian
+%2*sqrt(pi*tau)*exp(-tau*w^2) is divided out at the knots (the 1/M of the
+%type-2 NUFFT and of the definition cancel)
+kk=knots-k_c;
+plan.pre=exp(1i*2*pi*(targets*k_c.'));
+plan.post=exp(1i*2*pi*(kk*r_c.')).*...
+    prod(h./(2*sqrt(pi*tau)).*exp(tau.*(2*pi*kk).^2),2);
+plan.M=M;
+plan.K=size(targets,1);
+plan.Ng=Ng;
@@ -0,0 +1,2219 @@
+/*You can include any C libraries that you normally use*/
+#ifdef __linux__
+#define _GNU_SOURCE/*sched_setaffinity*/
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+#include "math.h"
+#include "stdint.h"
+#include "stdlib.h"
+#include "string.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifndef _WIN32
+#include <pthread.h>
+#define FGG_POOL/*persistent pthread pool, OpenMP or serial otherwise*/
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "mex.h"   /*This C library is required*/
+/*
+Persistent plans for the 3D Gaussian-gridding NUFFT. The convolution loops
+are the ones of FGG_Convolution3D.c (type 1, spreading) and
+FGG_Convolution3D_type2.c (type 2, interpolation), see page 448 in
+[1] L. Greengard and J.-Y. Lee, "Accelerating the Nonuniform Fast Fourier
+ Transform," SIAM Review, 2004.
+A plan stores everything that only depends on the knots (the closest grid
+index and the Gaussian factors E_1 and E_2 of every knot), so an iterative
+solver applying the operator hundreds of times no longer recomputes any
+exponential. Plans live between calls and are referred to from Matlab by a
+uint64 handle (see FGG_3d_plan.m). Data crosses the MEX boundary through
+the interleaved-complex API: inputs are read in place and the outputs are
+written straight into the returned mxArray, so the real/imaginary
+splitting and copying done around FGG_Convolution3D is gone.
+
+Line-structured knots: in polar-format SAR the knots of one pulse lie on a
+ray through the k-space origin at equally spaced frequencies, i.e. knot j
+of ray p is rayStart(p,:)+j*rayStep(p,:). A plan created with 'createrays'
+stores only the start and step of every ray and walks each ray with the
+recurrence of the Gaussian: with x the distance of the knot to its closest
+grid point, h = 2*pi/M_r and b the step along one axis,
+    exp(-(x+b)^2/(4tau)) = exp(-x^2/(4tau))*exp(-x*b/(2tau))*exp(-b^2/(4tau))
+and when the knot crosses into the next cell (x -> x-h)
+    exp(-(x-h)^2/(4tau)) = exp(-x^2/(4tau))*exp(x*h/(2tau))*exp(-h^2/(4tau)),
+where exp(x*h/(2tau)) is the E_2dummy factor that is needed anyway. All
+factors are updated by multiplications, so a ray costs 21 exponentials per
+FGG_RAY_RESTART knots instead of 6 per knot, and the plan needs no per-knot
+memory.
+
+Matrix mode: for fixed knots the spreading is a fixed sparse matrix A^T and
+the interpolation is A, with A the M x M_r(1)*M_r(2)*M_r(3) matrix holding
+the (2*M_sp)^3 Gaussian weights of every knot. 'materialize' stores A once
+in CSR (every row has exactly (2*M_sp)^3 entries, so the row pointers are
+implicit) and A^T in CSC, both with float weights and 32-bit indices, and
+from then on both transforms are multithreaded sparse matrix-vector
+products: rows are independent for the interpolation and columns are
+independent for the spreading, so no thread ever writes where another one
+does. Without a memory budget, 'materialize' only switches when the two
+matrices fit in half of the free RAM and M_sp <= 7 (float weights carry
+about 7 digits).
+
+Separable weights: the Gaussian of a knot is the tensor product of three
+1D vectors of 2*M_sp weights, so 'separable' stores these vectors (with
+E_1 folded into the x vector) and the wrapped closest index of every knot.
+The transforms then only multiply stored weights, which keeps the plan
+linear in M_sp: 6*M_sp values per knot instead of the (2*M_sp)^3 of the
+matrix. The weights can be kept in single, bfloat16 or half precision
+(about 7, 3 and 3 digits; half flushes weights below 6e-8 to zero).
+
+Tabulated kernel: the weight of grid point l along one axis is
+exp(-(x-l*h)^2/(4tau)) = E_1*E_2^l*E_3(l), a Gaussian of the fractional
+offset u = x/h-l. Instead of the E_2 power chain, which is sequential and
+loses digits at large M_sp, the kernel can be read from a table of the
+Gaussian sampled FGG_TABLE_DENSITY times per grid cell, with linear
+(about 7 digits) or cubic (about 12 digits) interpolation. All the 2*M_sp
+weights of a knot share the same interpolation coefficients and their
+table entries are FGG_TABLE_DENSITY apart, so with AVX2 four weights are
+read with one gather. The kernel is selected by an optional 8th entry of
+Scales: 0 recurrence (default), 1 linear table, 2 cubic table.
+
+Knot setup: the closest indices, E_1 and the E_2 powers of the knots are
+computed for FGG_KNOT_BATCH knots at a time with the knots in the SIMD
+lanes (structure of arrays), so the reciprocal, power chains and index
+wrapping of a batch run lane-parallel, and the scatter/gather loops then
+read the per-knot results. Rays are walked knot after knot (the
+recurrence along a ray is sequential), but the knots they produce fill
+the lanes the same way, in the serial transforms and in the z slabs.
+Tabulated kernels compute the weights of a batch knot by knot, and stored
+weights are read as they are.
+
+Anisotropic kernels: the half-width of the Gaussian can differ between the
+axes (e.g. a shorter kernel along the narrow elevation aperture), so a
+knot touches 2*M_sp(1) x 2*M_sp(2) x 2*M_sp(3) grid points. M_sp(d) is
+given by the length of E_3 of axis d; the first entry of Scales is the
+largest of them.
+
+NUMA: a large oversampled grid spans the memory of several sockets, and a
+page lives on the node of the thread that first touches it. With several
+threads the grid is split in z slabs, one per thread: the output grid of 'type1'
+is allocated uninitialized and every thread zeroes, and so places, its
+own slab, then spreads into it the knots whose footprint reaches the slab
+(the knots are bucketed once per plan by the z plane of their closest
+index; rays are cut once per plan into segments of knots of one plane,
+and a thread walks only the segments of its planes). 'type2'
+interpolates with every thread taking the knots centered in its slab. No
+two threads write the same grid point, so no atomics or private grids
+are needed. Only this type-1 grid is placed: the FFT, the deconvolution
+and everything else run in Matlab on arrays Matlab allocates. 'threading' sets the number of threads, asks
+for transparent huge pages (2 MB, madvise) on the grid and pins the
+worker threads ('close' packs them on consecutive CPUs, 'spread' spaces
+them over all sockets; Linux only). The calling Matlab thread is left
+unpinned. Pinning stays in effect until the next 'threading' call.
+
+Threads: the transforms of a solve are short and come by the hundred, so
+instead of forking a team for every call they run on one persistent
+pthread pool (one thread per online CPU unless set with 'threading'),
+whose workers spin briefly and then sleep between calls. Loops are handed
+out in chunks through an atomic counter, or split statically when a
+thread has to find its own slab again; the calling Matlab thread works as
+thread 0, and a loop started inside a parallel loop runs serially, so
+nesting never adds threads. Without pthreads (Windows) the same loops run
+on OpenMP when compiled with it, and serially otherwise. The pool is
+stopped when the MEX file is cleared.
+
+Compile with the interleaved-complex API (add -mavx2 -mfma for the table
+gathers, -fopenmp for the SIMD knot setup and, on Windows, threading; add
+-lpthread with glibc older than 2.34):
+mex -R2018a FGG_Plan3D.c
+mex -R2018a CFLAGS="$CFLAGS -fopenmp -mavx2 -mfma" LDFLAGS="$LDFLAGS -fopenmp" FGG_Plan3D.c
+
+Matlab use:
+    h = FGG_Plan3D('create',knots,E_3x,E_3y,E_3z,...
+        [M_sp, tau(1), tau(2), tau(3), M_r(1), M_r(2), M_r(3)]);
+    h = FGG_Plan3D('create',knots,E_3x,E_3y,E_3z,...
+        [M_sp, tau(1), tau(2), tau(3), M_r(1), M_r(2), M_r(3), kernel]);
+    h = FGG_Plan3D('createrays',rayStart,rayStep,rayLength,E_3x,E_3y,E_3z,...
+        [M_sp, tau(1), tau(2), tau(3), M_r(1), M_r(2), M_r(3)]);
+        the knots of ray p are rayStart(p,:)+(0:rayLength(p)-1).'*rayStep(p,:)
+        and are numbered ray after ray (see FGG_3d_plan.m)
+    f_tau = FGG_Plan3D('type1',h,f);
+        spreads the Mx1 data f onto the M_r(1)*M_r(2)*M_r(3) grid (same
+        output as FGG_Convolution3D, as one complex vector); an MxK f is
+        spread column by column into K grids, concurrently on K groups
+        of threads
+    f = FGG_Plan3D('type2',h,f_tau);
+        interpolates the grid f_tau at the knots (same output as
+        FGG_Convolution3D_type2, as one complex vector), or each of the K
+        columns of f_tau
+    isMatrix = FGG_Plan3D('materialize',h);
+    isMatrix = FGG_Plan3D('materialize',h,budget);
+        switches the plan to matrix mode if the matrices fit in budget
+        bytes (default: automatic, see above); returns true if it did
+    FGG_Plan3D('separable',h,weightClass);
+        stores the three 1D weight vectors of every knot, weightClass is
+        'double', 'single', 'bfloat16' or 'half'
+    F = FGG_Plan3D('crop',F_tau,[M_r offset N],E_4x,E_4y,E_4z,scale,ox,oy,oz);
+        crops the image of N(1)xN(2)xN(3) voxels at offset out of the
+        oversampled grid F_tau (K columns), deconvolves it by
+        E_4x*E_4y*E_4z*scale and writes voxel (i,j,k) straight to element
+        ox(i)+oy(j)+oz(k) (0-based) of the consumer's voxel layout (see
+        voxelLayout.m), so no permute of the volume is needed
+    f_tau = FGG_Plan3D('pad',x,[M_r offset N],E_4x,E_4y,E_4z,scale,ox,oy,oz);
+        the reverse: reads the voxels in that layout, deconvolves them and
+        zero pads them into the oversampled grid
+    FGG_Plan3D('destroy',h);
+    FGG_Plan3D('threading',numThreads,hugePages,pinning);
+        numThreads (0 keeps the current pool), hugePages (true/false)
+        and pinning ('none', 'close' or 'spread') for all plans
+knots = Mx3 k-space locations, already mapped into [0,2*pi)
+rayStart, rayStep = Px3 first knot and knot increment of every ray, in the
+    same scaled units as knots (the rays may leave [0,2*pi), the grid wraps)
+rayLength = number of knots of every ray (Px1, or a scalar for all rays)
+E_3x, E_3y, E_3z = the constant factors of the Gaussian (2*M_sp(d) each, see
+    FGG_3d_plan.m)
+ */
+#define PI 3.141592653589793
+#define FGG_PLAN_MAGIC 0x3344504747464e55ULL
+/*The factors of a ray are recomputed from scratch every FGG_RAY_RESTART
+knots, so the relative rounding error of the recurrence stays near 1e-13*/
+#define FGG_RAY_RESTART 512
+/*Storage of the separable weights*/
+#define FGG_WEIGHTS_NONE 0
+#define FGG_WEIGHTS_DOUBLE 1
+#define FGG_WEIGHTS_SINGLE 2
+#define FGG_WEIGHTS_BFLOAT16 3
+#define FGG_WEIGHTS_HALF 4
+/*Evaluation of the Gaussian*/
+#define FGG_KERNEL_RECURRENCE 0
+#define FGG_KERNEL_LINEAR 1
+#define FGG_KERNEL_CUBIC 2
+/*Table samples per grid cell*/
+#define FGG_TABLE_DENSITY 1024
+/*Knots whose setup (indices and weights) is computed together, one per
+SIMD lane*/
+#define FGG_KNOT_BATCH 16
+#if defined(_OPENMP) && !defined(_MSC_VER)
+#define FGG_SIMD _Pragma("omp simd")
+#else
+#define FGG_SIMD
+#endif
+/*Columns of A^T handled together by one thread in matrix mode*/
+#define FGG_COLUMN_BLOCK 4096
+/*Thread pinning*/
+#define FGG_PIN_NONE 0
+#define FGG_PIN_CLOSE 1
+#define FGG_PIN_SPREAD 2
+/*Threads of the pool, and polls of a worker before it goes to sleep*/
+#define FGG_MAX_THREADS 256
+#define FGG_POOL_SPIN 20000
+/*Size of a transparent huge page*/
+#define FGG_HUGE_PAGE ((size_t)2 << 20)
+
+typedef struct FGGPlan3D
+{
+    uint64_t magic;
+    struct FGGPlan3D *next;/*linked list of the live plans*/
+    size_t M;/*number of knots*/
+    int M_sp[3];/*half-width of the Gaussian along every axis*/
+    int TwoM_sp[3];
+    int offW[3];/*start of the x, y and z weights in a footprint*/
+    int nW;/*weights per footprint, TwoM_sp(1)+TwoM_sp(2)+TwoM_sp(3)*/
+    int M_r[3];/*oversampled grid size*/
+    double tau[3];/*Gaussian spreading factors*/
+    double *E_3[3];/*constant factors of the Gaussian, 2*M_sp(d) per axis*/
+    int *m;/*closest grid index [m1,m2,m3] of every knot*/
+    double *E_1;/*E_1x*E_1y*E_1z of every knot (recurrence kernel)*/
+    double *E_2;/*E_2xdummy, E_2ydummy, E_2zdummy of every knot, or the
+            fractional offsets x/h with a tabulated kernel*/
+    int kernel;/*FGG_KERNEL_**/
+    double *table[3];/*tabulated Gaussian of every axis*/
+    size_t numRays;/*0 for unstructured knots*/
+    size_t *rayLength;/*number of knots of every ray*/
+    double *rayStart;/*first knot of every ray (3 per ray)*/
+    double *rayStep;/*knot increment of every ray (3 per ray)*/
+    double cellE_1[3];/*exp(-h^2/(4tau)), h the grid spacing*/
+    double cellE_2[3];/*exp(h^2/(2tau))*/
+    int weightClass;/*FGG_WEIGHTS_* once separable weights are stored*/
+    int *base;/*wrapped closest grid index of every knot (3 per knot)*/
+    void *weights;/*wx, wy, wz of every knot (nW per knot)*/
+    int isMatrix;/*1 once the plan is materialized*/
+    size_t nnzRow;/*TwoM_sp(1)*TwoM_sp(2)*TwoM_sp(3) entries per row of A*/
+    uint32_t *csrCol;/*column of every entry of A, row after row*/
+    float *csrVal;
+    size_t *cscPtr;/*start of every column of A^T, N3+1 values*/
+    uint32_t *cscRow;
+    float *cscVal;
+    size_t *planeStart;/*start of the knots of every z plane, M_r(3)+1 values*/
+    size_t *planeKnots;/*knots sorted by the z plane of their closest index*/
+    size_t *segmentStart;/*start of the ray segments of every z plane*/
+    struct RaySegment *segments;/*ray segments sorted by z plane*/
+} FGGPlan3D;
+
+/*A run of consecutive knots of one ray whose closest z index falls in the
+same storage plane*/
+typedef struct RaySegment
+{
+    size_t ray;
+    size_t sample;/*first knot of the run within the ray*/
+    size_t knot;/*its number among all the knots*/
+    size_t count;
+} RaySegment;
+
+/*Position of a walk along the rays of a line-structured plan. E_1, E_2 and
+Q hold exp(-x^2/(4tau)), exp(x*h/(2tau)) and exp(-x*b/(2tau)) of the
+current knot along every axis*/
+typedef struct RayWalker
+{
+    int started;
+    size_t ray;
+    size_t sample;
+    int m[3];/*closest grid index, not wrapped*/
+    double E_1[3];
+    double E_2[3];
+    double Q[3];
+    double stepE_1[3];/*exp(-b^2/(4tau))*/
+    double stepQ[3];/*exp(-b^2/(2tau))*/
+    double stepE_2[3];/*exp(b*h/(2tau))*/
+    double cellQ[3];/*exp(h*b/(2tau))*/
+} RayWalker;
+
+static FGGPlan3D *livePlans = NULL;
+/*Set with 'threading'*/
+static int fggHugePages = 0;
+static int fggPinning = FGG_PIN_NONE;
+
+static void *planAlloc(size_t n)
+{
+    void *p = malloc(n > 0 ? n : 1);
+    if (p == NULL)
+        mexErrMsgIdAndTxt("FGG_Plan3D:outOfMemory",
+                "Could not allocate %.0f bytes for the NUFFT plan.", (double)n);
+    return p;
+}
+
+static void freePlan(FGGPlan3D *plan)
+{
+    int d;
+    plan->magic = 0;
+    for (d = 0; d < 3; d++)
+    {
+        free(plan->E_3[d]);
+        free(plan->table[d]);
+    }
+    free(plan->m);
+    free(plan->E_1);
+    free(plan->E_2);
+    free(plan->rayLength);
+    free(plan->rayStart);
+    free(plan->rayStep);
+    free(plan->base);
+    free(plan->weights);
+    free(plan->csrCol);
+    free(plan->csrVal);
+    free(plan->cscPtr);
+    free(plan->cscRow);
+    free(plan->cscVal);
+    free(plan->planeStart);
+    free(plan->planeKnots);
+    free(plan->segmentStart);
+    free(plan->segments);
+    free(plan);
+}
+
+static void freeAllPlans(void)
+{
+    FGGPlan3D *plan;
+    while (livePlans != NULL)
+    {
+        plan = livePlans;
+        livePlans = plan->next;
+        freePlan(plan);
+    }
+}
+
+/*Looks the handle up in the list of live plans, so stale handles (after
+"clear mex" or a destroy) raise an error instead of crashing Matlab*/
+static FGGPlan3D *getPlan(const mxArray *handle)
+{
+    FGGPlan3D *plan;
+    uint64_t address;
+    if (!mxIsUint64(handle) || mxGetNumberOfElements(handle) != 1)
+        mexErrMsgIdAndTxt("FGG_Plan3D:handle", "Expected a uint64 plan handle.");
+    address = *(uint64_t *)mxGetData(handle);
+    for (plan = livePlans; plan != NULL; plan = plan->next)
+        if ((uint64_t)(uintptr_t)plan == address && plan->magic == FGG_PLAN_MAGIC)
+            return plan;
+    mexErrMsgIdAndTxt("FGG_Plan3D:handle", "Invalid or destroyed plan handle.");
+    return NULL;
+}
+
+/*The E_2 vector of powers of the exponential,
+E_2 = E_2dummy.^((1-M_sp):M_sp), built with multiplications only (see
+FGG_Convolution3D.c)*/
+static void gaussianPowers(double *E_2, double E_2dummy, int M_sp)
+{
+    int j;
+    double E_2dummy_inv = 1/E_2dummy;
+    E_2[M_sp-1] = 1;
+    for (j = M_sp; j < 2*M_sp; j++)
+        E_2[j] = E_2dummy*E_2[j-1];
+    for (j = M_sp-2; j >= 0; j--)
+        E_2[j] = E_2[j+1]*E_2dummy_inv;
+}
+
+/*Grid indices influenced by a knot with closest index m along one axis;
+the convolution wraps around at the boundaries*/
+static void wrappedIndices(int *ind, int m, int M_r, int M_sp)
+{
+    int l, lo, hi, M_rd2 = M_r/2;
+    for (l = 1-M_sp; l <= M_sp; l++)
+    {
+        lo = (m+l+M_rd2) >= 0;/*true when reference is above the lower boundary*/
+        hi = (m+l) < M_rd2;/*true when reference is below the upper boundary*/
+        ind[M_sp+l-1] = m+l+(hi-lo)*M_r+M_rd2;/*number in [0, M_r-1]*/
+    }
+}
+
+/*Per-knot weights along each axis: w[d][j] = E_2[d][j]*E_3[d][j]*/
+/*Weights of one axis from the table: w[j] is the Gaussian at u = frac-l,
+l = j+1-M_sp, i.e. at table position (frac+2*M_sp-1-j)*FGG_TABLE_DENSITY,
+table[k] holding the Gaussian at u = (k-1)/FGG_TABLE_DENSITY-M_sp, with M_sp
+the half-width of axis d*/
+static void tableWeights(const FGGPlan3D *plan, int d, double frac, double *w)
+{
+    const double *T = plan->table[d];
+    double pos = frac*FGG_TABLE_DENSITY, t, c0, c1, c2, c3;
+    int j = 0, TwoM_sp = plan->TwoM_sp[d], base = (int)pos, k;
+    t = pos-base;
+    if (plan->kernel == FGG_KERNEL_LINEAR)
+    {
+#ifdef __AVX2__
+        __m256d vt = _mm256_set1_pd(t), lo, hi;
+        __m128i idx;
+        for (; j+4 <= TwoM_sp; j += 4)
+        {
+            k = base+(TwoM_sp-1-j)*FGG_TABLE_DENSITY+1;
+            idx = _mm_setr_epi32(k, k-FGG_TABLE_DENSITY, k-2*FGG_TABLE_DENSITY,
+                    k-3*FGG_TABLE_DENSITY);
+            lo = _mm256_i32gather_pd(T, idx, 8);
+            hi = _mm256_i32gather_pd(T+1, idx, 8);
+            _mm256_storeu_pd(w+j, _mm256_fmadd_pd(vt, _mm256_sub_pd(hi, lo), lo));
+        }
+#endif
+        for (; j < TwoM_sp; j++)
+        {
+            k = base+(TwoM_sp-1-j)*FGG_TABLE_DENSITY+1;
+            w[j] = T[k]+t*(T[k+1]-T[k]);
+        }
+        return;
+    }
+    /*4-point Lagrange interpolation at the nodes -1, 0, 1, 2*/
+    c0 = -t*(t-1)*(t-2)/6;
+    c1 = (t+1)*(t-1)*(t-2)/2;
+    c2 = -(t+1)*t*(t-2)/2;
+    c3 = (t+1)*t*(t-1)/6;
+#ifdef __AVX2__
+    {
+        __m256d v0 = _mm256_set1_pd(c0), v1 = _mm256_set1_pd(c1),
+                v2 = _mm256_set1_pd(c2), v3 = _mm256_set1_pd(c3), acc;
+        __m128i idx;
+        for (; j+4 <= TwoM_sp; j += 4)
+        {
+            k = base+(TwoM_sp-1-j)*FGG_TABLE_DENSITY;
+            idx = _mm_setr_epi32(k, k-FGG_TABLE_DENSITY, k-2*FGG_TABLE_DENSITY,
+                    k-3*FGG_TABLE_DENSITY);
+            acc = _mm256_mul_pd(v0, _mm256_i32gather_pd(T, idx, 8));
+            acc = _mm256_fmadd_pd(v1, _mm256_i32gather_pd(T+1, idx, 8), acc);
+            acc = _mm256_fmadd_pd(v2, _mm256_i32gather_pd(T+2, idx, 8), acc);
+            acc = _mm256_fmadd_pd(v3, _mm256_i32gather_pd(T+3, idx, 8), acc);
+            _mm256_storeu_pd(w+j, acc);
+        }
+    }
+#endif
+    for (; j < TwoM_sp; j++)
+    {
+        k = base+(TwoM_sp-1-j)*FGG_TABLE_DENSITY;
+        w[j] = c0*T[k]+c1*T[k+1]+c2*T[k+2]+c3*T[k+3];
+    }
+}
+
+static void knotWeights(const FGGPlan3D *plan, const double *E_2, double *wx,
+        double *wy, double *wz)
+{
+    double *w[3];
+    int d, j;
+    if (plan->kernel != FGG_KERNEL_RECURRENCE)/*E_2 holds x/h*/
+    {
+        tableWeights(plan, 0, E_2[0], wx);
+        tableWeights(plan, 1, E_2[1], wy);
+        tableWeights(plan, 2, E_2[2], wz);
+        return;
+    }
+    w[0] = wx;
+    w[1] = wy;
+    w[2] = wz;
+    for (d = 0; d < 3; d++)
+    {
+        gaussianPowers(w[d], E_2[d], plan->M_sp[d]);
+        for (j = 0; j < plan->TwoM_sp[d]; j++)
+            w[d][j] *= plan->E_3[d][j];
+    }
+}
+
+/*Starts the walk of ray w->ray along axis d at the knot "knot"*/
+static void rayAxisStart(const FGGPlan3D *plan, RayWalker *w, int d,
+        double knot, double b)
+{
+    double M_rd = plan->M_r[d], h = 2*PI/M_rd, tau = plan->tau[d], x;
+    w->m[d] = (int)floor(M_rd*knot/(2*PI));/*closest index*/
+    x = knot-w->m[d]*PI/(M_rd/2);
+    w->E_1[d] = exp(-x*x/(4*tau));
+    w->E_2[d] = exp(x*PI/(M_rd*tau));
+    w->Q[d] = exp(-x*b/(2*tau));
+    w->stepE_1[d] = exp(-b*b/(4*tau));
+    w->stepQ[d] = exp(-b*b/(2*tau));
+    w->stepE_2[d] = exp(b*h/(2*tau));
+    w->cellQ[d] = exp(h*b/(2*tau));
+}
+
+/*Moves the walk along axis d by one step b, to the knot "knot"*/
+static void rayAxisStep(const FGGPlan3D *plan, RayWalker *w, int d, double knot)
+{
+    int m = (int)floor(plan->M_r[d]*knot/(2*PI));
+    w->E_1[d] *= w->Q[d]*w->stepE_1[d];
+    w->Q[d] *= w->stepQ[d];
+    w->E_2[d] *= w->stepE_2[d];
+    while (w->m[d] < m)/*the knot crossed into the next cell: x -> x-h*/
+    {
+        w->E_1[d] *= w->E_2[d]*plan->cellE_1[d];
+        w->E_2[d] /= plan->cellE_2[d];
+        w->Q[d] *= w->cellQ[d];
+        w->m[d]++;
+    }
+    while (w->m[d] > m)/*the knot crossed into the previous cell: x -> x+h*/
+    {
+        w->E_1[d] *= plan->cellE_1[d]/w->E_2[d];
+        w->E_2[d] *= plan->cellE_2[d];
+        w->Q[d] /= w->cellQ[d];
+        w->m[d]--;
+    }
+}
+
+/*With a tabulated kernel a knot only needs its closest index and its
+fractional offset, which are cheaper than the recurrence*/
+static void rayAxisOffset(const FGGPlan3D *plan, RayWalker *w, int d, double knot)
+{
+    double M_rd = plan->M_r[d];
+    w->m[d] = (int)floor(M_rd*knot/(2*PI));
+    w->E_1[d] = 1;
+    w->E_2[d] = M_rd*knot/(2*PI)-w->m[d];
+}
+
+/*Advances the walk to the next knot, ray after ray*/
+static void rayNext(const FGGPlan3D *plan, RayWalker *w)
+{
+    const double *start, *step;
+    double j;
+    int d;
+    if (plan->kernel != FGG_KERNEL_RECURRENCE)
+    {
+        if (w->started && ++w->sample < plan->rayLength[w->ray])
+        {
+            j = (double)w->sample;
+            for (d = 0; d < 3; d++)
+                rayAxisOffset(plan, w, d, plan->rayStart[3*w->ray+d]+j*plan->rayStep[3*w->ray+d]);
+            return;
+        }
+        if (w->started)
+            w->ray++;
+        w->sample = 0;
+        while (plan->rayLength[w->ray] == 0)
+            w->ray++;
+        w->started = 1;
+        for (d = 0; d < 3; d++)
+            rayAxisOffset(plan, w, d, plan->rayStart[3*w->ray+d]);
+        return;
+    }
+    if (w->started)
+    {
+        w->sample++;
+        if (w->sample < plan->rayLength[w->ray])
+        {
+            start = plan->rayStart+3*w->ray;
+            step = plan->rayStep+3*w->ray;
+            j = (double)w->sample;
+            if (w->sample%FGG_RAY_RESTART == 0)/*bound the rounding drift*/
+                for (d = 0; d < 3; d++)
+                    rayAxisStart(plan, w, d, start[d]+j*step[d], step[d]);
+            else
+                for (d = 0; d < 3; d++)/*the knot itself is not accumulated*/
+                    rayAxisStep(plan, w, d, start[d]+j*step[d]);
+            return;
+        }
+        w->ray++;
+    }
+    w->sample = 0;
+    while (plan->rayLength[w->ray] == 0)
+        w->ray++;
+    w->started = 1;
+    start = plan->rayStart+3*w->ray;
+    step = plan->rayStep+3*w->ray;
+    for (d = 0; d < 3; d++)
+        rayAxisStart(plan, w, d, start[d], step[d]);
+}
+
+/*Moves the walk to knot "sample" of ray "ray", as if it had walked there
+(a restart of the recurrence)*/
+static void raySeek(const FGGPlan3D *plan, RayWalker *w, size_t ray, size_t sample)
+{
+    const double *start = plan->rayStart+3*ray, *step = plan->rayStep+3*ray;
+    double j = (double)sample;
+    int d;
+    w->started = 1;
+    w->ray = ray;
+    w->sample = sample;
+    for (d = 0; d < 3; d++)
+        if (plan->kernel != FGG_KERNEL_RECURRENCE)
+            rayAxisOffset(plan, w, d, start[d]+j*step[d]);
+        else
+            rayAxisStart(plan, w, d, start[d]+j*step[d], step[d]);
+}
+
+/*Closest grid index (wrapped into [0,M_r-1]), E_1 and E_2dummy of the
+current knot of a walk*/
+static void walkerGeometry(const FGGPlan3D *plan, const RayWalker *w,
+        int *m, double *E_1, double *E_2)
+{
+    int d;
+    for (d = 0; d < 3; d++)
+    {
+        m[d] = w->m[d]%plan->M_r[d];
+        if (m[d] < 0)
+            m[d] += plan->M_r[d];
+        E_2[d] = w->E_2[d];
+    }
+    *E_1 = w->E_1[0]*w->E_1[1]*w->E_1[2];
+}
+
+/*Closest grid index (wrapped into [0,M_r-1]), E_1 and E_2dummy of knot i.
+Knots must be visited in order when the plan is line-structured*/
+static void knotGeometry(const FGGPlan3D *plan, size_t i, RayWalker *w,
+        int *m, double *E_1, double *E_2)
+{
+    int d;
+    if (plan->numRays == 0)
+    {
+        for (d = 0; d < 3; d++)
+        {
+            m[d] = plan->m[3*i+d];
+            E_2[d] = plan->E_2[3*i+d];
+        }
+        *E_1 = plan->E_1 != NULL ? plan->E_1[i] : 1;
+        return;
+    }
+    rayNext(plan, w);
+    walkerGeometry(plan, w, m, E_1, E_2);
+}
+
+/*Conversions of the separable weights, rounding to nearest*/
+static uint16_t toBfloat16(float v)
+{
+    uint32_t u;
+    memcpy(&u, &v, sizeof(u));
+    u += 0x7fff+((u >> 16) & 1);
+    return (uint16_t)(u >> 16);
+}
+
+static float fromBfloat16(uint16_t b)
+{
+    uint32_t u = (uint32_t)b << 16;
+    float v;
+    memcpy(&v, &u, sizeof(v));
+    return v;
+}
+
+static uint16_t toHalf(float v)
+{
+    uint32_t u, sign, mant, h;
+    int e, shift;
+    memcpy(&u, &v, sizeof(u));
+    sign = (u >> 16) & 0x8000;
+    e = (int)((u >> 23) & 0xff)-127+15;
+    mant = u & 0x7fffff;
+    if (e >= 31)
+        return (uint16_t)(sign | 0x7c00);
+    if (e <= 0)/*subnormal half*/
+    {
+        if (e < -10)
+            return (uint16_t)sign;
+        mant |= 0x800000;
+        shift = 14-e;
+        h = mant >> shift;
+        if ((mant >> (shift-1)) & 1)
+            h++;
+        return (uint16_t)(sign | h);
+    }
+    h = ((uint32_t)e << 10) | (mant >> 13);
+    if (mant & 0x1000)/*a carry into the exponent is still correct*/
+        h++;
+    return (uint16_t)(sign | h);
+}
+
+static float fromHalf(uint16_t h)
+{
+    int e = (h >> 10) & 0x1f, mant = h & 0x3ff;
+    float v;
+    if (e == 0)
+        v = ldexpf((float)mant, -24);
+    else if (e == 31)
+        v = HUGE_VALF;
+    else
+        v = ldexpf((float)(mant+1024), e-25);
+    return (h & 0x8000) ? -v : v;
+}
+
+/*Grid indices and weights of the footprint of knot i: xind holds the x, y
+and z indices and w the x, y and z weights (2*M_sp(d) each, starting at
+offW(d)). Returns the
+factor E_1 that multiplies the tensor product*/
+static double knotFootprint(const FGGPlan3D *plan, size_t i, RayWalker *walker,
+        int *xind, double *w)
+{
+    const int *offW = plan->offW;
+    int m[3], d, j, n = plan->nW;
+    double E_1, E_2[3];
+    if (plan->weightClass == FGG_WEIGHTS_NONE)
+    {
+        knotGeometry(plan, i, walker, m, &E_1, E_2);
+        knotWeights(plan, E_2, w, w+offW[1], w+offW[2]);
+        for (d = 0; d < 3; d++)
+            wrappedIndices(xind+offW[d], m[d], plan->M_r[d], plan->M_sp[d]);
+        return E_1;
+    }
+    for (d = 0; d < 3; d++)
+        wrappedIndices(xind+offW[d], plan->base[3*i+d], plan->M_r[d], plan->M_sp[d]);
+    switch (plan->weightClass)
+    {
+        case FGG_WEIGHTS_DOUBLE:
+            memcpy(w, (const double *)plan->weights+i*n, n*sizeof(double));
+            break;
+        case FGG_WEIGHTS_SINGLE:
+            for (j = 0; j < n; j++)
+                w[j] = ((const float *)plan->weights)[i*n+j];
+            break;
+        case FGG_WEIGHTS_BFLOAT16:
+            for (j = 0; j < n; j++)
+                w[j] = fromBfloat16(((const uint16_t *)plan->weights)[i*n+j]);
+            break;
+        default:
+            for (j = 0; j < n; j++)
+                w[j] = fromHalf(((const uint16_t *)plan->weights)[i*n+j]);
+    }
+    return 1;
+}
+
+/*Stores the separable weights of every knot in place of the per-knot
+factors*/
+static void storeSeparable(FGGPlan3D *plan, int weightClass)
+{
+    int m[3], d, j, n = plan->nW;
+    size_t i, bytes;
+    double E_1, E_2[3], *w;
+    RayWalker walker;
+    if (plan->isMatrix || plan->weightClass != FGG_WEIGHTS_NONE)
+        return;
+    bytes = weightClass == FGG_WEIGHTS_DOUBLE ? sizeof(double)
+            : weightClass == FGG_WEIGHTS_SINGLE ? sizeof(float) : sizeof(uint16_t);
+    plan->base = (int *)planAlloc(3*plan->M*sizeof(int));
+    plan->weights = planAlloc(plan->M*n*bytes);
+    w = (double *)planAlloc(n*sizeof(double));
+    walker.started = 0;
+    walker.ray = 0;
+    for (i = 0; i < plan->M; i++)
+    {
+        knotGeometry(plan, i, &walker, m, &E_1, E_2);
+        knotWeights(plan, E_2, w, w+plan->offW[1], w+plan->offW[2]);
+        for (d = 0; d < 3; d++)
+            plan->base[3*i+d] = m[d];
+        for (j = 0; j < plan->TwoM_sp[0]; j++)
+            w[j] *= E_1;
+        for (j = 0; j < n; j++)
+            switch (weightClass)
+            {
+                case FGG_WEIGHTS_DOUBLE:
+                    ((double *)plan->weights)[i*n+j] = w[j];
+                    break;
+                case FGG_WEIGHTS_SINGLE:
+                    ((float *)plan->weights)[i*n+j] = (float)w[j];
+                    break;
+                case FGG_WEIGHTS_BFLOAT16:
+                    ((uint16_t *)plan->weights)[i*n+j] = toBfloat16((float)w[j]);
+                    break;
+                default:
+                    ((uint16_t *)plan->weights)[i*n+j] = toHalf((float)w[j]);
+            }
+    }
+    free(w);
+    free(plan->m);
+    free(plan->E_1);
+    free(plan->E_2);
+    plan->m = NULL;
+    plan->E_1 = NULL;
+    plan->E_2 = NULL;
+    plan->weightClass = weightClass;
+}
+
+/*Indices and weights of FGG_KNOT_BATCH knots, knot after knot as written
+by knotFootprint, plus their geometry and lane-major scratch arrays*/
+typedef struct KnotBatch
+{
+    int *ind;
+    double *w;
+    double E_1[FGG_KNOT_BATCH];
+    size_t knot[FGG_KNOT_BATCH];/*knot numbers of the batch*/
+    int n;/*knots in the batch*/
+    int m[3*FGG_KNOT_BATCH];/*closest indices, axis after axis*/
+    double E_2[3*FGG_KNOT_BATCH];/*E_2dummy (or x/h), axis after axis*/
+    double *power;/*E_2 powers, 2*max(M_sp) x FGG_KNOT_BATCH*/
+    int *lane;/*indices, 2*max(M_sp) x FGG_KNOT_BATCH*/
+} KnotBatch;
+
+static void batchAlloc(const FGGPlan3D *plan, KnotBatch *kb)
+{
+    size_t n = (size_t)plan->nW*FGG_KNOT_BATCH, nLane;
+    nLane = (size_t)FGG_KNOT_BATCH*(plan->TwoM_sp[0] > plan->TwoM_sp[1] ? plan->TwoM_sp[0] : plan->TwoM_sp[1]);
+    if (nLane < (size_t)FGG_KNOT_BATCH*plan->TwoM_sp[2])
+        nLane = (size_t)FGG_KNOT_BATCH*plan->TwoM_sp[2];
+    kb->ind = (int *)planAlloc(n*sizeof(int));
+    kb->w = (double *)planAlloc(n*sizeof(double));
+    kb->power = (double *)planAlloc(nLane*sizeof(double));
+    kb->lane = (int *)planAlloc(nLane*sizeof(int));
+    kb->n = 0;
+}
+
+static void batchFree(KnotBatch *kb)
+{
+    free(kb->ind);
+    free(kb->w);
+    free(kb->power);
+    free(kb->lane);
+}
+
+/*Appends knot k, with the geometry given by knotGeometry, to a batch that
+is not full*/
+static void batchPush(KnotBatch *kb, size_t k, const int *m, double E_1,
+        const double *E_2)
+{
+    int d, b = kb->n++;
+    kb->knot[b] = k;
+    kb->E_1[b] = E_1;
+    for (d = 0; d < 3; d++)
+    {
+        kb->m[d*FGG_KNOT_BATCH+b] = m[d];
+        kb->E_2[d*FGG_KNOT_BATCH+b] = E_2[d];
+    }
+}
+
+/*Indices and weights of the knots pushed into a batch. With the recurrence
+kernel the knots sit in the SIMD lanes (the unused lanes repeat lane 0),
+and the result is bitwise the same as knotFootprint*/
+static void batchLanes(const FGGPlan3D *plan, KnotBatch *kb)
+{
+    int TwoM_sp, M_sp, nW = plan->nW, offW, M_r, M_rd2, n = kb->n, b, d, j;
+    double inv[FGG_KNOT_BATCH], up[FGG_KNOT_BATCH], down[FGG_KNOT_BATCH], E_2b[3];
+    const double *E_3;
+    double *E_2, *P = kb->power;
+    int *m, *L = kb->lane;
+    if (plan->kernel != FGG_KERNEL_RECURRENCE)
+    {
+        for (b = 0; b < n; b++)
+        {
+            for (d = 0; d < 3; d++)
+                E_2b[d] = kb->E_2[d*FGG_KNOT_BATCH+b];
+            knotWeights(plan, E_2b, kb->w+b*nW, kb->w+b*nW+plan->offW[1], kb->w+b*nW+plan->offW[2]);
+            for (d = 0; d < 3; d++)
+                wrappedIndices(kb->ind+b*nW+plan->offW[d], kb->m[d*FGG_KNOT_BATCH+b],
+                        plan->M_r[d], plan->M_sp[d]);
+        }
+        return;
+    }
+    for (d = 0; d < 3; d++)
+    {
+        E_3 = plan->E_3[d];
+        E_2 = kb->E_2+d*FGG_KNOT_BATCH;
+        m = kb->m+d*FGG_KNOT_BATCH;
+        M_sp = plan->M_sp[d];
+        TwoM_sp = plan->TwoM_sp[d];
+        offW = plan->offW[d];
+        M_r = plan->M_r[d];
+        M_rd2 = M_r/2;
+        for (b = n; b < FGG_KNOT_BATCH; b++)
+        {
+            E_2[b] = E_2[0];
+            m[b] = m[0];
+        }
+        FGG_SIMD
+        for (b = 0; b < FGG_KNOT_BATCH; b++)
+        {
+            inv[b] = 1/E_2[b];
+            up[b] = 1;
+            down[b] = 1;
+            P[(M_sp-1)*FGG_KNOT_BATCH+b] = E_3[M_sp-1];
+        }
+        /*the power chains of gaussianPowers, one knot per lane*/
+        for (j = M_sp; j < TwoM_sp; j++)
+        {
+            FGG_SIMD
+            for (b = 0; b < FGG_KNOT_BATCH; b++)
+            {
+                up[b] = E_2[b]*up[b];
+                P[j*FGG_KNOT_BATCH+b] = up[b]*E_3[j];
+            }
+        }
+        for (j = M_sp-2; j >= 0; j--)
+        {
+            FGG_SIMD
+            for (b = 0; b < FGG_KNOT_BATCH; b++)
+            {
+                down[b] = down[b]*inv[b];
+                P[j*FGG_KNOT_BATCH+b] = down[b]*E_3[j];
+            }
+        }
+        /*wrappedIndices, one knot per lane*/
+        for (j = 0; j < TwoM_sp; j++)
+        {
+            FGG_SIMD
+            for (b = 0; b < FGG_KNOT_BATCH; b++)
+            {
+                int v = m[b]+j+1-M_sp;
+                L[j*FGG_KNOT_BATCH+b] = v+M_rd2+((v < M_rd2)-(v+M_rd2 >= 0))*M_r;
+            }
+        }
+        /*back to one footprint per knot*/
+        for (b = 0; b < n; b++)
+            for (j = 0; j < TwoM_sp; j++)
+            {
+                kb->w[b*nW+offW+j] = P[j*FGG_KNOT_BATCH+b];
+                kb->ind[b*nW+offW+j] = L[j*FGG_KNOT_BATCH+b];
+            }
+    }
+}
+
+/*Sets up the knots i0 to i0+FGG_KNOT_BATCH-1 (fewer at the end) of the
+count knots of list, or of all knots in order when list is NULL (rays are
+walked, so their knots must come in order). Stored weights are read knot
+by knot, the others go through batchLanes*/
+static void knotBatch(const FGGPlan3D *plan, size_t i0, const size_t *list,
+        size_t count, RayWalker *walker, KnotBatch *kb)
+{
+    int n, b, m[3], nW = plan->nW;
+    double E_1, E_2[3];
+    size_t k;
+    n = count-i0 < FGG_KNOT_BATCH ? (int)(count-i0) : FGG_KNOT_BATCH;
+    kb->n = 0;
+    for (b = 0; b < n; b++)
+    {
+        k = list != NULL ? list[i0+b] : i0+b;
+        if (plan->weightClass != FGG_WEIGHTS_NONE)
+        {
+            kb->knot[b] = k;
+            kb->E_1[b] = knotFootprint(plan, k, walker, kb->ind+b*nW, kb->w+b*nW);
+            kb->n++;
+            continue;
+        }
+        knotGeometry(plan, k, walker, m, &E_1, E_2);
+        batchPush(kb, k, m, E_1, E_2);
+    }
+    if (plan->weightClass == FGG_WEIGHTS_NONE)
+        batchLanes(plan, kb);
+}
+
+/*Reads the Gaussian constants shared by both kinds of plans, prhs points
+at E_3x, E_3y, E_3z and Scales*/
+static FGGPlan3D *planHeader(const mxArray *prhs[])
+{
+    FGGPlan3D *plan;
+    const double *Scales;
+    double h, u;
+    size_t k, n;
+    int d;
+    if (mxGetNumberOfElements(prhs[3]) < 7)
+        mexErrMsgIdAndTxt("FGG_Plan3D:create",
+                "Scales must be [M_sp, tau(1), tau(2), tau(3), M_r(1), M_r(2), M_r(3)(, kernel)].");
+    Scales = mxGetDoubles(prhs[3]);
+    plan = (FGGPlan3D *)planAlloc(sizeof(FGGPlan3D));
+    memset(plan, 0, sizeof(FGGPlan3D));
+    plan->kernel = mxGetNumberOfElements(prhs[3]) > 7 ? (int)Scales[7] : FGG_KERNEL_RECURRENCE;
+    if (plan->kernel < FGG_KERNEL_RECURRENCE || plan->kernel > FGG_KERNEL_CUBIC)
+    {
+        freePlan(plan);
+        mexErrMsgIdAndTxt("FGG_Plan3D:create", "The kernel must be 0 (recurrence), 1 (linear) or 2 (cubic).");
+    }
+    for (d = 0; d < 3; d++)
+    {
+        plan->tau[d] = Scales[1+d];
+        plan->M_r[d] = (int)Scales[4+d];
+        h = 2*PI/plan->M_r[d];
+        plan->cellE_1[d] = exp(-h*h/(4*plan->tau[d]));
+        plan->cellE_2[d] = exp(h*h/(2*plan->tau[d]));
+        /*the half-width of every axis is given by the length of its E_3*/
+        n = mxGetNumberOfElements(prhs[d]);
+        if (n < 2 || n%2 != 0 || n > (size_t)Scales[0]*2)
+        {
+            freePlan(plan);
+            mexErrMsgIdAndTxt("FGG_Plan3D:create",
+                    "E_3 vectors must have 2*M_sp(d) elements, M_sp(d) <= M_sp = Scales(1).");
+        }
+        plan->TwoM_sp[d] = (int)n;
+        plan->M_sp[d] = plan->TwoM_sp[d]/2;
+        plan->offW[d] = plan->nW;
+        plan->nW += plan->TwoM_sp[d];
+        plan->E_3[d] = (double *)planAlloc(n*sizeof(double));
+        memcpy(plan->E_3[d], mxGetDoubles(prhs[d]), n*sizeof(double));
+        if (plan->kernel != FGG_KERNEL_RECURRENCE)
+        {
+            /*exp(-(u*h)^2/(4tau)) for u = (k-1)/FGG_TABLE_DENSITY-M_sp, one
+            sample before and two after the support for the interpolation*/
+            n = (size_t)plan->TwoM_sp[d]*FGG_TABLE_DENSITY+4;
+            plan->table[d] = (double *)planAlloc(n*sizeof(double));
+            for (k = 0; k < n; k++)
+            {
+                u = ((double)k-1)/FGG_TABLE_DENSITY-plan->M_sp[d];
+                plan->table[d][k] = exp(-u*u*h*h/(4*plan->tau[d]));
+            }
+        }
+    }
+    return plan;
+}
+
+static void registerPlan(FGGPlan3D *plan)
+{
+    plan->magic = FGG_PLAN_MAGIC;
+    plan->next = livePlans;
+    livePlans = plan;
+}
+
+static FGGPlan3D *createPlan(int nrhs, const mxArray *prhs[])
+{
+    FGGPlan3D *plan;
+    const double *knots;
+    double knot, M_rd, tau;
+    size_t i, M;
+    int d;
+    if (nrhs != 6)
+        mexErrMsgIdAndTxt("FGG_Plan3D:create",
+                "Use FGG_Plan3D('create',knots,E_3x,E_3y,E_3z,Scales).");
+    if (!mxIsDouble(prhs[1]) || mxIsComplex(prhs[1]) || mxGetN(prhs[1]) != 3)
+        mexErrMsgIdAndTxt("FGG_Plan3D:create", "knots must be a real Mx3 double matrix.");
+    M = mxGetM(prhs[1]);
+    knots = mxGetDoubles(prhs[1]);
+
+    plan = planHeader(prhs+2);
+    plan->M = M;
+    plan->m = (int *)planAlloc(3*M*sizeof(int));
+    plan->E_2 = (double *)planAlloc(3*M*sizeof(double));
+    if (plan->kernel != FGG_KERNEL_RECURRENCE)
+    {
+        for (i = 0; i < M; i++)
+            for (d = 0; d < 3; d++)
+            {
+                M_rd = plan->M_r[d];
+                knot = knots[i+d*M];
+                plan->m[3*i+d] = (int)floor(M_rd*knot/(2*PI));
+                plan->E_2[3*i+d] = M_rd*knot/(2*PI)-plan->m[3*i+d];
+            }
+        registerPlan(plan);
+        return plan;
+    }
+    plan->E_1 = (double *)planAlloc(M*sizeof(double));
+
+    /*The knot-dependent part of the convolution loop, done once per plan.
+    The knots are stored axis after axis (structure of arrays), so each
+    axis is one lane-parallel loop over the knots*/
+    for (i = 0; i < M; i++)
+        plan->E_1[i] = 1;
+    for (d = 0; d < 3; d++)
+    {
+        M_rd = plan->M_r[d];
+        tau = plan->tau[d];
+        FGG_SIMD
+        for (i = 0; i < M; i++)
+        {
+            double knot = knots[i+d*M], x;
+            int m = (int)floor(M_rd*knot/(2*PI));/*closest index*/
+            x = knot-m*PI/(M_rd/2);
+            plan->m[3*i+d] = m;
+            plan->E_1[i] *= exp(-x*x/(4*tau));
+            plan->E_2[3*i+d] = exp(x*PI/(M_rd*tau));
+        }
+    }
+
+    registerPlan(plan);
+    return plan;
+}
+
+/*Plan for line-structured knots: only the rays are stored*/
+static FGGPlan3D *createRayPlan(int nrhs, const mxArray *prhs[])
+{
+    FGGPlan3D *plan;
+    const double *lengths;
+    size_t p, P, numLengths;
+    if (nrhs != 8)
+        mexErrMsgIdAndTxt("FGG_Plan3D:createrays",
+                "Use FGG_Plan3D('createrays',rayStart,rayStep,rayLength,E_3x,E_3y,E_3z,Scales).");
+    P = mxGetM(prhs[1]);
+    if (!mxIsDouble(prhs[1]) || mxIsComplex(prhs[1]) || mxGetN(prhs[1]) != 3
+            || !mxIsDouble(prhs[2]) || mxIsComplex(prhs[2]) || mxGetN(prhs[2]) != 3
+            || mxGetM(prhs[2]) != P)
+        mexErrMsgIdAndTxt("FGG_Plan3D:createrays",
+                "rayStart and rayStep must be real Px3 double matrices.");
+    numLengths = mxGetNumberOfElements(prhs[3]);
+    if (!mxIsDouble(prhs[3]) || (numLengths != 1 && numLengths != P))
+        mexErrMsgIdAndTxt("FGG_Plan3D:createrays",
+                "rayLength must be a scalar or have one value per ray.");
+    lengths = mxGetDoubles(prhs[3]);
+
+    plan = planHeader(prhs+4);
+    plan->numRays = P;
+    plan->rayLength = (size_t *)planAlloc(P*sizeof(size_t));
+    plan->rayStart = (double *)planAlloc(3*P*sizeof(double));
+    plan->rayStep = (double *)planAlloc(3*P*sizeof(double));
+    plan->M = 0;
+    for (p = 0; p < P; p++)
+    {
+        plan->rayLength[p] = (size_t)lengths[numLengths == 1 ? 0 : p];
+        plan->M += plan->rayLength[p];
+        /*Px3 column major to 3 values per ray*/
+        plan->rayStart[3*p] = mxGetDoubles(prhs[1])[p];
+        plan->rayStart[3*p+1] = mxGetDoubles(prhs[1])[p+P];
+        plan->rayStart[3*p+2] = mxGetDoubles(prhs[1])[p+2*P];
+        plan->rayStep[3*p] = mxGetDoubles(prhs[2])[p];
+        plan->rayStep[3*p+1] = mxGetDoubles(prhs[2])[p+P];
+        plan->rayStep[3*p+2] = mxGetDoubles(prhs[2])[p+2*P];
+    }
+
+    registerPlan(plan);
+    return plan;
+}
+
+/*Body of a parallel loop: runs the iterations [begin,end) on pool thread t*/
+typedef void (*PoolBody)(void *ctx, size_t begin, size_t end, int t);
+
+#ifdef FGG_POOL
+/*Persistent pool: numThreads-1 workers plus the calling Matlab thread
+(thread 0). A job is published by bumping generation; workers spin on it
+for FGG_POOL_SPIN polls before sleeping on a condition variable, so the
+hundreds of transforms of a solve do not pay a thread wake-up each.
+Dynamic jobs hand out chunks with an atomic counter (no lock), static jobs
+give thread t always the same share of the iterations*/
+typedef struct ThreadPool
+{
+    int numThreads;
+    pthread_t *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    PoolBody body;
+    void *ctx;
+    size_t n;
+    size_t chunk;/*0 for a static job*/
+    size_t next;/*next iteration to hand out*/
+    int pending;/*workers still running the job*/
+    unsigned long generation;
+    int stop;
+} ThreadPool;
+
+static ThreadPool pool;
+static int poolStarted = 0;
+static __thread int inPool = 0;/*nested loops run serially*/
+
+static void poolRunJob(int t)
+{
+    size_t b, e, n = pool.n, chunk = pool.chunk, T = (size_t)pool.numThreads;
+    if (chunk == 0)
+    {
+        b = n*t/T;
+        e = n*(t+1)/T;
+        if (b < e)
+            pool.body(pool.ctx, b, e, t);
+        return;
+    }
+    while ((b = __atomic_fetch_add(&pool.next, chunk, __ATOMIC_RELAXED)) < n)
+    {
+        e = b+chunk < n ? b+chunk : n;
+        pool.body(pool.ctx, b, e, t);
+    }
+}
+
+static void *poolWorker(void *arg)
+{
+    int t = (int)(intptr_t)arg, spin;
+    unsigned long seen = 0, g = 0;
+    inPool = 1;
+    for (;;)
+    {
+        for (spin = 0; spin < FGG_POOL_SPIN; spin++)
+            if ((g = __atomic_load_n(&pool.generation, __ATOMIC_ACQUIRE)) != seen)
+                break;
+        if (g == seen)
+        {
+            pthread_mutex_lock(&pool.lock);
+            while ((g = pool.generation) == seen)
+                pthread_cond_wait(&pool.wake, &pool.lock);
+            pthread_mutex_unlock(&pool.lock);
+        }
+        seen = g;
+        if (__atomic_load_n(&pool.stop, __ATOMIC_ACQUIRE))
+            return NULL;
+        poolRunJob(t);
+        if (__atomic_sub_fetch(&pool.pending, 1, __ATOMIC_ACQ_REL) == 0)
+        {
+            pthread_mutex_lock(&pool.lock);
+            pthread_cond_signal(&pool.done);
+            pthread_mutex_unlock(&pool.lock);
+        }
+    }
+}
+
+static void poolStop(void)
+{
+    int t;
+    if (!poolStarted)
+        return;
+    pthread_mutex_lock(&pool.lock);
+    __atomic_store_n(&pool.stop, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&pool.generation, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+    for (t = 1; t < pool.numThreads; t++)
+        pthread_join(pool.workers[t-1], NULL);
+    free(pool.workers);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.wake);
+    pthread_cond_destroy(&pool.done);
+    poolStarted = 0;
+}
+
+/*Starts numThreads threads (0: one per online CPU); a pool whose
+workers cannot all be created keeps the ones it got*/
+static void poolStart(int numThreads)
+{
+    int t;
+    if (numThreads <= 0)
+        numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (numThreads > FGG_MAX_THREADS)
+        numThreads = FGG_MAX_THREADS;
+    if (numThreads < 1)
+        numThreads = 1;
+    memset(&pool, 0, sizeof(pool));
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+    pthread_cond_init(&pool.done, NULL);
+    pool.workers = (pthread_t *)planAlloc(numThreads*sizeof(pthread_t));
+    pool.numThreads = 1;
+    for (t = 1; t < numThreads; t++)
+    {
+        if (pthread_create(&pool.workers[t-1], NULL, poolWorker, (void *)(intptr_t)t) != 0)
+            break;
+        pool.numThreads++;
+    }
+    poolStarted = 1;
+}
+#endif
+
+/*Threads used by the transforms*/
+static int numThreads(void)
+{
+#ifdef FGG_POOL
+    if (!poolStarted)
+        poolStart(0);
+    return pool.numThreads;
+#elif defined(_OPENMP)
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+/*Runs body over the iterations 0 to n-1. chunk > 0 hands out chunks of
+chunk iterations to whichever thread is free, chunk = 0 splits the
+iterations evenly so that thread t always gets the same share (what
+first-touch placement needs). Without the pool the loop runs on OpenMP or
+serially; a loop started from inside a parallel loop runs serially, so
+nested use never adds threads*/
+static void parallelFor(size_t n, size_t chunk, PoolBody body, void *ctx)
+{
+    int T = numThreads();
+    if (n == 0)
+        return;
+#ifdef FGG_POOL
+    if (T > 1 && !inPool)
+    {
+        int spin;
+        pool.body = body;
+        pool.ctx = ctx;
+        pool.n = n;
+        pool.chunk = chunk;
+        pool.next = 0;
+        pool.pending = pool.numThreads-1;
+        pthread_mutex_lock(&pool.lock);
+        __atomic_add_fetch(&pool.generation, 1, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&pool.wake);
+        pthread_mutex_unlock(&pool.lock);
+        inPool = 1;
+        poolRunJob(0);
+        inPool = 0;
+        for (spin = 0; spin < FGG_POOL_SPIN; spin++)
+            if (__atomic_load_n(&pool.pending, __ATOMIC_ACQUIRE) == 0)
+                return;
+        pthread_mutex_lock(&pool.lock);
+        while (__atomic_load_n(&pool.pending, __ATOMIC_ACQUIRE) != 0)
+            pthread_cond_wait(&pool.done, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+        return;
+    }
+#elif defined(_OPENMP)
+    if (T > 1 && !omp_in_parallel())
+    {
+        ptrdiff_t b, numChunks;
+        if (chunk == 0)
+        {
+#pragma omp parallel for schedule(static, 1) num_threads(T)
+            for (b = 0; b < T; b++)
+                if (n*b/T < n*(b+1)/T)
+                    body(ctx, n*b/T, n*(b+1)/T, omp_get_thread_num());
+            return;
+        }
+        numChunks = (ptrdiff_t)((n+chunk-1)/chunk);
+#pragma omp parallel for schedule(dynamic) num_threads(T)
+        for (b = 0; b < numChunks; b++)
+            body(ctx, b*chunk, (size_t)(b+1)*chunk < n ? (b+1)*chunk : n, omp_get_thread_num());
+        return;
+    }
+#endif
+    body(ctx, 0, n, 0);
+}
+
+/*Asks for transparent huge pages on the 2 MB-aligned part of
+[p, p+bytes), before the pages are first touched (Linux)*/
+static void adviseHugePages(void *p, size_t bytes)
+{
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    uintptr_t a = ((uintptr_t)p+FGG_HUGE_PAGE-1) & ~(uintptr_t)(FGG_HUGE_PAGE-1);
+    uintptr_t e = ((uintptr_t)p+bytes) & ~(uintptr_t)(FGG_HUGE_PAGE-1);
+    if (fggHugePages && e > a)
+        madvise((void *)a, e-a, MADV_HUGEPAGE);
+#endif
+}
+
+#ifdef __linux__
+typedef struct PinJob
+{
+    const cpu_set_t *allowed;
+    const int *cpus;
+    int numCpus;
+    int T;
+} PinJob;
+
+static void pinBody(void *ctx, size_t begin, size_t end, int t)
+{
+    const PinJob *job = (const PinJob *)ctx;
+    cpu_set_t set;
+    if (t == 0)/*the Matlab thread keeps its own affinity*/
+        return;
+    if (fggPinning == FGG_PIN_NONE)
+        set = *job->allowed;
+    else
+    {
+        CPU_ZERO(&set);
+        CPU_SET(job->cpus[fggPinning == FGG_PIN_CLOSE ? t%job->numCpus
+                : (int)((double)t*job->numCpus/job->T)%job->numCpus], &set);
+    }
+    sched_setaffinity(0, sizeof(set), &set);
+}
+#endif
+
+/*Pins the pool workers (Linux): FGG_PIN_CLOSE puts thread t on the t-th
+allowed CPU, FGG_PIN_SPREAD spaces the threads evenly over the allowed CPUs
+so that every socket gets its share, FGG_PIN_NONE restores the affinity
+the process started with. Thread 0 is the Matlab thread and is never
+pinned: it outlives the call, and the threads Matlab creates later would
+inherit its mask*/
+static void pinThreads(void)
+{
+#ifdef __linux__
+    static cpu_set_t allowed;
+    static int haveAllowed = 0;
+    static int cpus[CPU_SETSIZE];
+    PinJob job;
+    int c;
+    if (!haveAllowed)
+    {
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            return;
+        haveAllowed = 1;
+    }
+    job.allowed = &allowed;
+    job.cpus = cpus;
+    job.numCpus = 0;
+    job.T = numThreads();
+    for (c = 0; c < CPU_SETSIZE; c++)
+        if (CPU_ISSET(c, &allowed))
+            cpus[job.numCpus++] = c;
+    if (job.numCpus > 0)/*one iteration per thread*/
+        parallelFor((size_t)job.T, 0, pinBody, &job);
+#endif
+}
+
+/*Free physical memory in bytes*/
+static double availableMemory(void)
+{
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    GlobalMemoryStatusEx(&status);
+    return (double)status.ullAvailPhys;
+#elif defined(_SC_AVPHYS_PAGES)
+    return (double)sysconf(_SC_AVPHYS_PAGES)*(double)sysconf(_SC_PAGE_SIZE);
+#else
+    return 0.5*(double)sysconf(_SC_PHYS_PAGES)*(double)sysconf(_SC_PAGE_SIZE);
+#endif
+}
+
+/*Bytes needed by the CSR and CSC matrices of a plan*/
+static double matrixMemory(const FGGPlan3D *plan)
+{
+    double nnz = (double)plan->M*plan->TwoM_sp[0]*plan->TwoM_sp[1]*plan->TwoM_sp[2];
+    double N3 = (double)plan->M_r[0]*plan->M_r[1]*plan->M_r[2];
+    return 2*nnz*(sizeof(uint32_t)+sizeof(float))+(N3+1)*sizeof(size_t);
+}
+
+/*Builds A (CSR) by walking the knots once, then A^T (CSC) by a counting
+transpose. Returns 0 without changing the plan if the matrices would need
+more than budget bytes; budget < 0 selects the automatic choice*/
+static int materializePlan(FGGPlan3D *plan, double budget)
+{
+    const int *TwoM_sp = plan->TwoM_sp, *offW = plan->offW;
+    int nW = plan->nW, l1, l2, l3, b;
+    int *xind, *yind, *zind;
+    double *wx, *wy, *wz, E_1, V1, V2;
+    size_t i, c, k, N3, N2, nnzRow, ind, indz, *next;
+    uint32_t *col;
+    float *val;
+    RayWalker walker;
+    KnotBatch batch;
+    if (plan->isMatrix)
+        return 1;
+    N3 = (size_t)plan->M_r[0]*plan->M_r[1]*plan->M_r[2];
+    N2 = (size_t)plan->M_r[0]*plan->M_r[1];
+    if (plan->M >= UINT32_MAX || N3 >= UINT32_MAX)
+        return 0;
+    if (budget < 0)
+    {
+        if (plan->M_sp[0] > 7 || plan->M_sp[1] > 7 || plan->M_sp[2] > 7)
+            return 0;
+        budget = 0.5*availableMemory();
+    }
+    if (matrixMemory(plan) > budget)
+        return 0;
+
+    nnzRow = (size_t)TwoM_sp[0]*TwoM_sp[1]*TwoM_sp[2];
+    plan->csrCol = (uint32_t *)planAlloc(plan->M*nnzRow*sizeof(uint32_t));
+    plan->csrVal = (float *)planAlloc(plan->M*nnzRow*sizeof(float));
+    batchAlloc(plan, &batch);
+    walker.started = 0;
+    walker.ray = 0;
+    col = plan->csrCol;
+    val = plan->csrVal;
+    for (i = 0; i < plan->M; i++)
+    {
+        if (i%FGG_KNOT_BATCH == 0)
+            knotBatch(plan, i, NULL, plan->M, &walker, &batch);
+        b = (int)(i%FGG_KNOT_BATCH);
+        xind = batch.ind+b*nW;
+        yind = xind+offW[1];
+        zind = xind+offW[2];
+        wx = batch.w+b*nW;
+        wy = wx+offW[1];
+        wz = wx+offW[2];
+        E_1 = batch.E_1[b];
+        for (l3 = 0; l3 < TwoM_sp[2]; l3++)/*same order as spread()*/
+        {
+            V2 = E_1*wz[l3];
+            indz = N2*zind[l3];
+            for (l2 = 0; l2 < TwoM_sp[1]; l2++)
+            {
+                V1 = V2*wy[l2];
+                ind = indz+(size_t)plan->M_r[0]*yind[l2];
+                for (l1 = 0; l1 < TwoM_sp[0]; l1++)
+                {
+                    *col++ = (uint32_t)(ind+xind[l1]);
+                    *val++ = (float)(V1*wx[l1]);
+                }
+            }
+        }
+    }
+    batchFree(&batch);
+
+    /*Transpose: count the entries of every column, then scatter the rows
+    in increasing order so every column of A^T is sorted by knot*/
+    plan->cscPtr = (size_t *)planAlloc((N3+1)*sizeof(size_t));
+    plan->cscRow = (uint32_t *)planAlloc(plan->M*nnzRow*sizeof(uint32_t));
+    plan->cscVal = (float *)planAlloc(plan->M*nnzRow*sizeof(float));
+    memset(plan->cscPtr, 0, (N3+1)*sizeof(size_t));
+    for (k = 0; k < plan->M*nnzRow; k++)
+        plan->cscPtr[plan->csrCol[k]+1]++;
+    for (c = 0; c < N3; c++)
+        plan->cscPtr[c+1] += plan->cscPtr[c];
+    next = (size_t *)planAlloc(N3*sizeof(size_t));
+    memcpy(next, plan->cscPtr, N3*sizeof(size_t));
+    for (i = 0; i < plan->M; i++)
+        for (k = i*nnzRow; k < (i+1)*nnzRow; k++)
+        {
+            c = plan->csrCol[k];
+            plan->cscRow[next[c]] = (uint32_t)i;
+            plan->cscVal[next[c]++] = plan->csrVal[k];
+        }
+    free(next);
+
+    /*The per-knot factors and weights are not needed anymore*/
+    free(plan->base);
+    free(plan->weights);
+    plan->base = NULL;
+    plan->weights = NULL;
+    plan->weightClass = FGG_WEIGHTS_NONE;
+    free(plan->m);
+    free(plan->E_1);
+    free(plan->E_2);
+    plan->m = NULL;
+    plan->E_1 = NULL;
+    plan->E_2 = NULL;
+    free(plan->planeStart);
+    free(plan->planeKnots);
+    plan->planeStart = NULL;
+    plan->planeKnots = NULL;
+    plan->nnzRow = nnzRow;
+    plan->isMatrix = 1;
+    return 1;
+}
+
+/*Arguments of the parallel transforms*/
+typedef struct TransformJob
+{
+    const FGGPlan3D *plan;
+    const double *in;/*f (type 1) or ftau (type 2)*/
+    int inIsComplex;
+    double *out;
+    int type1;
+    int numSlabs;/*slabs per column*/
+    size_t inColumn, outColumn;/*doubles per column of in and out*/
+    KnotBatch *batch;/*one per thread*/
+} TransformJob;
+
+/*Type 1 in matrix mode: out = A^T*f, column blocks begin to end-1*/
+static void spreadMatrixBody(void *ctx, size_t begin, size_t end, int t)
+{
+    const TransformJob *job = (const TransformJob *)ctx;
+    const FGGPlan3D *plan = job->plan;
+    const double *f = job->in;
+    double *out = job->out, sr, si, w;
+    size_t N3 = (size_t)plan->M_r[0]*plan->M_r[1]*plan->M_r[2], b, c, k, cEnd;
+    for (b = begin; b < end; b++)
+    {
+        cEnd = (b+1)*FGG_COLUMN_BLOCK < N3 ? (b+1)*FGG_COLUMN_BLOCK : N3;
+        for (c = b*FGG_COLUMN_BLOCK; c < cEnd; c++)
+        {
+            sr = 0;
+            si = 0;
+            if (job->inIsComplex)
+                for (k = plan->cscPtr[c]; k < plan->cscPtr[c+1]; k++)
+                {
+                    w = plan->cscVal[k];
+                    sr += w*f[2*(size_t)plan->cscRow[k]];
+                    si += w*f[2*(size_t)plan->cscRow[k]+1];
+                }
+            else
+                for (k = plan->cscPtr[c]; k < plan->cscPtr[c+1]; k++)
+                    sr += plan->cscVal[k]*f[plan->cscRow[k]];
+            out[2*c] = sr;
+            out[2*c+1] = si;
+        }
+    }
+}
+
+/*Type 1 in matrix mode, one column block per task*/
+static void spreadMatrix(const FGGPlan3D *plan, const double *f, int fIsComplex,
+        double *out)
+{
+    size_t N3 = (size_t)plan->M_r[0]*plan->M_r[1]*plan->M_r[2];
+    TransformJob job;
+    job.plan = plan;
+    job.in = f;
+    job.inIsComplex = fIsComplex;
+    job.out = out;
+    parallelFor((N3+FGG_COLUMN_BLOCK-1)/FGG_COLUMN_BLOCK, 1, spreadMatrixBody, &job);
+}
+
+/*Type 2 in matrix mode: out = A*ftau, knots begin to end-1*/
+static void interpMatrixBody(void *ctx, size_t begin, size_t end, int t)
+{
+    const TransformJob *job = (const TransformJob *)ctx;
+    const FGGPlan3D *plan = job->plan;
+    const double *ftau = job->in;
+    const uint32_t *col;
+    const float *val;
+    double sr, si;
+    size_t i, k;
+    for (i = begin; i < end; i++)
+    {
+        col = plan->csrCol+i*plan->nnzRow;
+        val = plan->csrVal+i*plan->nnzRow;
+        sr = 0;
+        si = 0;
+        if (job->inIsComplex)
+            for (k = 0; k < plan->nnzRow; k++)
+            {
+                sr += val[k]*ftau[2*(size_t)col[k]];
+                si += val[k]*ftau[2*(size_t)col[k]+1];
+            }
+        else
+            for (k = 0; k < plan->nnzRow; k++)
+                sr += val[k]*ftau[col[k]];
+        job->out[2*i] = sr;
+        job->out[2*i+1] = si;
+    }
+}
+
+/*Type 2 in matrix mode, the rows split evenly between the threads*/
+static void interpMatrix(const FGGPlan3D *plan, const double *ftau,
+        int ftauIsComplex, double *out)
+{
+    TransformJob job;
+    job.plan = plan;
+    job.in = ftau;
+    job.inIsComplex = ftauIsComplex;
+    job.out = out;
+    parallelFor(plan->M, 0, interpMatrixBody, &job);
+}
+
+static void destroyPlan(const mxArray *handle)
+{
+    FGGPlan3D *plan = getPlan(handle), **link;
+    for (link = &livePlans; *link != NULL; link = &(*link)->next)
+        if (*link == plan)
+        {
+            *link = plan->next;
+            break;
+        }
+    freePlan(plan);
+}
+
+/*Adds f*Gaussian of knot b of a batch to the planes z0 to z1-1 of the grid
+out (interleaved complex)*/
+static void spreadKnot(const FGGPlan3D *plan, const KnotBatch *kb, int b,
+        double fr, double fi, int z0, int z1, double *out)
+{
+    const int *TwoM_sp = plan->TwoM_sp, *offW = plan->offW;
+    const int *xind = kb->ind+b*plan->nW, *yind = xind+offW[1], *zind = xind+offW[2];
+    const double *wx = kb->w+b*plan->nW, *wy = wx+offW[1], *wz = wx+offW[2];
+    double V0r = fr*kb->E_1[b], V0i = fi*kb->E_1[b], V1r, V1i, V2r, V2i;
+    size_t N2 = (size_t)plan->M_r[0]*plan->M_r[1], ind, indz;
+    int l1, l2, l3;
+    for (l3 = 0; l3 < TwoM_sp[2]; l3++)/*loop over z dimension*/
+    {
+        if (zind[l3] < z0 || zind[l3] >= z1)/*plane of another thread*/
+            continue;
+        V2r = V0r*wz[l3];
+        V2i = V0i*wz[l3];
+        indz = N2*zind[l3];
+        for (l2 = 0; l2 < TwoM_sp[1]; l2++)/*loop over y dimension*/
+        {
+            V1r = V2r*wy[l2];
+            V1i = V2i*wy[l2];
+            ind = indz+(size_t)plan->M_r[0]*yind[l2];
+            for (l1 = 0; l1 < TwoM_sp[0]; l1++)/*loop over x dimension*/
+            {
+                out[2*(ind+xind[l1])] += V1r*wx[l1];
+                out[2*(ind+xind[l1])+1] += V1i*wx[l1];
+            }
+        }
+    }
+}
+
+/*Sum over the grid of ftau*Gaussian of knot b of a batch, written to
+out[0] (real part) and out[1] (imaginary part)*/
+static void interpKnot(const FGGPlan3D *plan, const KnotBatch *kb, int b,
+        const double *ftau, int ftauIsComplex, double *out)
+{
+    const int *TwoM_sp = plan->TwoM_sp, *offW = plan->offW;
+    const int *xind = kb->ind+b*plan->nW, *yind = xind+offW[1], *zind = xind+offW[2];
+    const double *wx = kb->w+b*plan->nW, *wy = wx+offW[1], *wz = wx+offW[2];
+    double V0r = kb->E_1[b], V1r, V2r, w, sr = 0, si = 0;
+    size_t N2 = (size_t)plan->M_r[0]*plan->M_r[1], ind, indz;
+    int l1, l2, l3;
+    for (l3 = 0; l3 < TwoM_sp[2]; l3++)/*loop over z dimension*/
+    {
+        V2r = V0r*wz[l3];
+        indz = N2*zind[l3];
+        for (l2 = 0; l2 < TwoM_sp[1]; l2++)/*loop over y dimension*/
+        {
+            V1r = V2r*wy[l2];
+            ind = indz+(size_t)plan->M_r[0]*yind[l2];
+            if (ftauIsComplex)
+                for (l1 = 0; l1 < TwoM_sp[0]; l1++)/*loop over x dimension*/
+                {
+                    w = V1r*wx[l1];
+                    sr += w*ftau[2*(ind+xind[l1])];
+                    si += w*ftau[2*(ind+xind[l1])+1];
+                }
+            else
+                for (l1 = 0; l1 < TwoM_sp[0]; l1++)
+                    sr += V1r*wx[l1]*ftau[ind+xind[l1]];
+        }
+    }
+    out[0] = sr;
+    out[1] = si;
+}
+
+/*Type 1: out = sum over knots of f(i)*Gaussian, f is interleaved complex
+(or real when fIsComplex is 0) and out is interleaved complex*/
+static void spread(const FGGPlan3D *plan, const double *f, int fIsComplex,
+        double *out)
+{
+    int b;
+    RayWalker walker;
+    KnotBatch batch;
+    size_t i;
+    memset(out, 0, 2*(size_t)plan->M_r[0]*plan->M_r[1]*plan->M_r[2]*sizeof(double));
+    batchAlloc(plan, &batch);
+    walker.started = 0;
+    walker.ray = 0;
+    for (i = 0; i < plan->M; i++)
+    {
+        if (i%FGG_KNOT_BATCH == 0)
+            knotBatch(plan, i, NULL, plan->M, &walker, &batch);
+        b = (int)(i%FGG_KNOT_BATCH);
+        spreadKnot(plan, &batch, b, fIsComplex ? f[2*i] : f[i],
+                fIsComplex ? f[2*i+1] : 0, 0, plan->M_r[2], out);
+    }
+    batchFree(&batch);
+}
+
+/*Type 2: out(i) = sum over the grid of ftau*Gaussian, ftau is interleaved
+complex (or real when ftauIsComplex is 0) and out is interleaved complex*/
+static void interp(const FGGPlan3D *plan, const double *ftau,
+        int ftauIsComplex, double *out)
+{
+    int b;
+    RayWalker walker;
+    KnotBatch batch;
+    size_t i;
+    batchAlloc(plan, &batch);
+    walker.started = 0;
+    walker.ray = 0;
+    for (i = 0; i < plan->M; i++)
+    {
+        if (i%FGG_KNOT_BATCH == 0)
+            knotBatch(plan, i, NULL, plan->M, &walker, &batch);
+        b = (int)(i%FGG_KNOT_BATCH);
+        interpKnot(plan, &batch, b, ftau, ftauIsComplex, out+2*i);
+    }
+    batchFree(&batch);
+}
+
+/*Planes [z0,z1) of the grid owned by thread t of T*/
+static void slabPlanes(const FGGPlan3D *plan, int t, int T, int *z0, int *z1)
+{
+    *z0 = (int)((double)plan->M_r[2]*t/T);
+    *z1 = (int)((double)plan->M_r[2]*(t+1)/T);
+}
+
+/*Storage plane of the closest z index m of a knot (the z footprint is this
+plane +(1-M_sp(3)):M_sp(3), wrapped)*/
+static int knotPlane(const FGGPlan3D *plan, int m)
+{
+    int M_r = plan->M_r[2];
+    return ((m+M_r/2)%M_r+M_r)%M_r;
+}
+
+/*Cuts the rays into segments of consecutive knots of one storage plane
+and buckets the segments by plane, so that a slab thread walks only the
+parts of the rays that reach its slab. The z index is monotonic along a
+ray, so a ray gives one segment per plane it crosses (per wrap of the
+grid). The rays are walked twice, to count and to fill the buckets*/
+static void raySegments(FGGPlan3D *plan)
+{
+    RayWalker walker;
+    RaySegment *seg = NULL;
+    int m[3], p, P = plan->M_r[2], plane, pass, prevPlane = 0;
+    double E_1, E_2[3];
+    size_t i, prevRay = 0, *next = NULL;
+    plan->segmentStart = (size_t *)planAlloc((P+1)*sizeof(size_t));
+    memset(plan->segmentStart, 0, (P+1)*sizeof(size_t));
+    for (pass = 0; pass < 2; pass++)
+    {
+        walker.started = 0;
+        walker.ray = 0;
+        for (i = 0; i < plan->M; i++)
+        {
+            knotGeometry(plan, i, &walker, m, &E_1, E_2);
+            plane = knotPlane(plan, m[2]);
+            if (i > 0 && walker.ray == prevRay && plane == prevPlane)
+            {
+                if (pass == 1)
+                    seg->count++;
+                continue;
+            }
+            prevRay = walker.ray;
+            prevPlane = plane;
+            if (pass == 0)
+            {
+                plan->segmentStart[plane+1]++;
+                continue;
+            }
+            seg = plan->segments+next[plane]++;
+            seg->ray = walker.ray;
+            seg->sample = walker.sample;
+            seg->knot = i;
+            seg->count = 1;
+        }
+        if (pass == 1)
+            break;
+        for (p = 0; p < P; p++)
+            plan->segmentStart[p+1] += plan->segmentStart[p];
+        plan->segments = (RaySegment *)planAlloc((plan->segmentStart[P] > 0 ? plan->segmentStart[P] : 1)*sizeof(RaySegment));
+        next = (size_t *)planAlloc(P*sizeof(size_t));
+        memcpy(next, plan->segmentStart, P*sizeof(size_t));
+    }
+    free(next);
+}
+
+/*Buckets the knots by knotPlane, once per plan. Plans walking rays
+without stored weights have no per-knot indices, their rays are cut into
+segments per plane instead (raySegments)*/
+static void planeBuckets(FGGPlan3D *plan)
+{
+    size_t i, *next;
+    int p, P = plan->M_r[2];
+    const int *m = plan->weightClass != FGG_WEIGHTS_NONE ? plan->base : plan->m;
+    if (m == NULL && plan->numRays > 0 && plan->segments == NULL)
+        raySegments(plan);
+    if (plan->planeKnots != NULL || m == NULL)
+        return;
+    plan->planeStart = (size_t *)planAlloc((P+1)*sizeof(size_t));
+    plan->planeKnots = (size_t *)planAlloc(plan->M*sizeof(size_t));
+    memset(plan->planeStart, 0, (P+1)*sizeof(size_t));
+    for (i = 0; i < plan->M; i++)
+        plan->planeStart[knotPlane(plan, m[3*i+2])+1]++;
+    for (p = 0; p < P; p++)
+        plan->planeStart[p+1] += plan->planeStart[p];
+    next = (size_t *)planAlloc(P*sizeof(size_t));
+    memcpy(next, plan->planeStart, P*sizeof(size_t));
+    for (i = 0; i < plan->M; i++)
+        plan->planeKnots[next[knotPlane(plan, m[3*i+2])]++] = i;
+    free(next);
+}
+
+/*Sets up the knots pushed into a batch and spreads them into the planes
+[z0,z1) of out, or interpolates them, then empties the batch*/
+static void slabBatch(const TransformJob *job, KnotBatch *kb, const double *in,
+        double *out, int z0, int z1)
+{
+    int b;
+    size_t k;
+    batchLanes(job->plan, kb);
+    for (b = 0; b < kb->n; b++)
+    {
+        k = kb->knot[b];
+        if (job->type1)
+            spreadKnot(job->plan, kb, b, job->inIsComplex ? in[2*k] : in[k],
+                    job->inIsComplex ? in[2*k+1] : 0, z0, z1, out);
+        else
+            interpKnot(job->plan, kb, b, in, job->inIsComplex, out+2*k);
+    }
+    kb->n = 0;
+}
+
+/*Type 1 and type 2 with the grid split in z slabs, one per thread. Every
+thread zeroes (and so first touches) its own slab, spreads only into its
+slab the knots whose footprint reaches it, and interpolates the knots
+centered in its slab, so the grid pages live on the node of the thread
+that works on them and no two threads write the same grid point. The
+knots are visited plane bucket by plane bucket, or, for rays, segment by
+segment of the planes, walking each segment from its first knot. With several
+columns the iterations are (column, slab) pairs, so each column is
+transformed by its own group of numSlabs threads*/
+static void slabBody(void *ctx, size_t begin, size_t end, int t)
+{
+    const TransformJob *job = (const TransformJob *)ctx;
+    const FGGPlan3D *plan = job->plan;
+    const double *in;
+    double *out, E_1, E_2[3];
+    int M_sp = plan->M_sp[2], M_r = plan->M_r[2], inIsComplex = job->inIsComplex;
+    int z0, z1, lo, hi, p, q, b, m[3];
+    size_t N2 = (size_t)plan->M_r[0]*plan->M_r[1], unit, column, i, i0, n, k, s;
+    const RaySegment *seg;
+    KnotBatch *kb = job->batch+t;
+    RayWalker walker;
+    for (unit = begin; unit < end; unit++)
+    {
+        column = unit/job->numSlabs;
+        in = job->in+column*job->inColumn;
+        out = job->out+column*job->outColumn;
+        slabPlanes(plan, (int)(unit%job->numSlabs), job->numSlabs, &z0, &z1);
+        /*the knots whose footprint reaches planes [z0,z1) are centered in
+        planes [lo,hi), those interpolated by this thread in [z0,z1)*/
+        lo = job->type1 ? z0-M_sp : z0;
+        hi = job->type1 ? z1+M_sp-1 : z1;
+        if (hi-lo > M_r)
+            hi = lo+M_r;
+        if (job->type1)
+            memset(out+2*N2*z0, 0, 2*N2*(z1-z0)*sizeof(double));
+        if (z1 == z0)
+            continue;
+        if (plan->planeKnots != NULL)
+        {
+            for (p = lo; p < hi; p++)
+            {
+                q = (p%M_r+M_r)%M_r;
+                n = plan->planeStart[q+1]-plan->planeStart[q];
+                for (i0 = 0; i0 < n; i0 += FGG_KNOT_BATCH)
+                {
+                    knotBatch(plan, i0, plan->planeKnots+plan->planeStart[q], n, NULL, kb);
+                    for (b = 0; b < kb->n; b++)
+                    {
+                        k = kb->knot[b];
+                        if (job->type1)
+                            spreadKnot(plan, kb, b, inIsComplex ? in[2*k] : in[k],
+                                    inIsComplex ? in[2*k+1] : 0, z0, z1, out);
+                        else
+                            interpKnot(plan, kb, b, in, inIsComplex, out+2*k);
+                    }
+                }
+            }
+            continue;
+        }
+        for (p = lo; p < hi; p++)
+        {
+            q = (p%M_r+M_r)%M_r;
+            for (s = plan->segmentStart[q]; s < plan->segmentStart[q+1]; s++)
+            {
+                seg = plan->segments+s;
+                raySeek(plan, &walker, seg->ray, seg->sample);
+                for (i = 0; i < seg->count; i++)
+                {
+                    if (i > 0)
+                        rayNext(plan, &walker);
+                    walkerGeometry(plan, &walker, m, &E_1, E_2);
+                    batchPush(kb, seg->knot+i, m, E_1, E_2);
+                    if (kb->n == FGG_KNOT_BATCH)
+                        slabBatch(job, kb, in, out, z0, z1);
+                }
+            }
+        }
+        if (kb->n > 0)
+            slabBatch(job, kb, in, out, z0, z1);
+    }
+}
+
+/*The K columns of in (inColumn doubles apart) are transformed into the
+columns of out (outColumn doubles apart) at the same time: the T threads
+are partitioned into K groups of T/K threads, one group and as many z
+slabs per column, or, with more columns than threads, every thread takes
+whole columns*/
+static void slabTransform(const FGGPlan3D *plan, int type1, const double *in,
+        int inIsComplex, size_t inColumn, double *out, size_t outColumn,
+        int T, int K)
+{
+    TransformJob job;
+    int t, numBatches = numThreads();
+    job.plan = plan;
+    job.in = in;
+    job.inIsComplex = inIsComplex;
+    job.out = out;
+    job.type1 = type1;
+    job.numSlabs = T >= K ? T/K : 1;
+    job.inColumn = inColumn;
+    job.outColumn = outColumn;
+    job.batch = (KnotBatch *)planAlloc(numBatches*sizeof(KnotBatch));
+    for (t = 0; t < numBatches; t++)
+        batchAlloc(plan, job.batch+t);
+    /*static split, so slab t is always placed and worked on by thread t*/
+    parallelFor((size_t)K*job.numSlabs, 0, slabBody, &job);
+    for (t = 0; t < numBatches; t++)
+        batchFree(job.batch+t);
+    free(job.batch);
+}
+
+/*Pointer to the data of a double array, read in place*/
+static const double *inputData(const mxArray *a, int *isComplex)
+{
+    if (!mxIsDouble(a))
+        mexErrMsgIdAndTxt("FGG_Plan3D:input", "Data must be double.");
+    *isComplex = mxIsComplex(a);
+    return *isComplex ? (const double *)mxGetComplexDoubles(a) : mxGetDoubles(a);
+}
+
+/*Arguments of 'crop' and 'pad': the image of N(1)xN(2)xN(3) voxels sits
+at offset in the oversampled grid of M_r points (x fastest, as the FFT
+leaves it), and voxel (i,j,k) of the image is element
+layout[0][i]+layout[1][j]+layout[2][k] of the layout of the consumer*/
+typedef struct LayoutJob
+{
+    const double *in;
+    int inIsComplex;
+    double *out;
+    int M_r[3], offset[3], N[3];
+    const double *E_4[3];/*deconvolution factors of the three axes*/
+    double scale;
+    const double *layout[3];/*0-based offsets, as doubles*/
+} LayoutJob;
+
+/*'crop': out(layout) = F_tau(image)*E_4x*E_4y*E_4z*scale, iterations are
+(column, image plane) pairs*/
+static void cropBody(void *ctx, size_t begin, size_t end, int t)
+{
+    const LayoutJob *job = (const LayoutJob *)ctx;
+    size_t N3 = (size_t)job->M_r[0]*job->M_r[1]*job->M_r[2];
+    size_t V = (size_t)job->N[0]*job->N[1]*job->N[2], u, c, s, d;
+    double w, wz;
+    int i, j, k;
+    for (u = begin; u < end; u++)
+    {
+        c = u/job->N[2];
+        k = (int)(u%job->N[2]);
+        wz = job->E_4[2][k]*job->scale;
+        for (j = 0; j < job->N[1]; j++)
+            for (i = 0; i < job->N[0]; i++)
+            {
+                s = c*N3+(size_t)(i+job->offset[0])+(size_t)job->M_r[0]*((j+job->offset[1])
+                        +(size_t)job->M_r[1]*(k+job->offset[2]));
+                d = c*V+(size_t)(job->layout[0][i]+job->layout[1][j]+job->layout[2][k]);
+                w = job->E_4[0][i]*job->E_4[1][j]*wz;
+                job->out[2*d] = w*(job->inIsComplex ? job->in[2*s] : job->in[s]);
+                job->out[2*d+1] = job->inIsComplex ? w*job->in[2*s+1] : 0;
+            }
+    }
+}
+
+/*'pad': the oversampled grid is zero outside the image and
+x(layout)*E_4x*E_4y*E_4z*scale inside, iterations are (column, grid plane)
+pairs, so every plane is written (and first touched) by one thread*/
+static void padBody(void *ctx, size_t begin, size_t end, int t)
+{
+    const LayoutJob *job = (const LayoutJob *)ctx;
+    size_t N2 = (size_t)job->M_r[0]*job->M_r[1], N3 = N2*job->M_r[2];
+    size_t V = (size_t)job->N[0]*job->N[1]*job->N[2], u, c, s, d;
+    double w, wz, *plane;
+    int i, j, k;
+    for (u = begin; u < end; u++)
+    {
+        c = u/job->M_r[2];
+        k = (int)(u%job->M_r[2])-job->offset[2];
+        plane = job->out+2*(c*N3+N2*(u%job->M_r[2]));
+        memset(plane, 0, 2*N2*sizeof(double));
+        if (k < 0 || k >= job->N[2])
+            continue;
+        wz = job->E_4[2][k]*job->scale;
+        for (j = 0; j < job->N[1]; j++)
+            for (i = 0; i < job->N[0]; i++)
+            {
+                s = c*V+(size_t)(job->layout[0][i]+job->layout[1][j]+job->layout[2][k]);
+                d = (size_t)(i+job->offset[0])+(size_t)job->M_r[0]*(j+job->offset[1]);
+                w = job->E_4[0][i]*job->E_4[1][j]*wz;
+                plane[2*d] = w*(job->inIsComplex ? job->in[2*s] : job->in[s]);
+                plane[2*d+1] = job->inIsComplex ? w*job->in[2*s+1] : 0;
+            }
+    }
+}
+
+/*FGG_Plan3D('crop',F_tau,geometry,E_4x,E_4y,E_4z,scale,ox,oy,oz) and
+FGG_Plan3D('pad',x,geometry,...), with geometry = [M_r offset N]*/
+static void layoutTransform(int crop, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    LayoutJob job;
+    const double *geometry;
+    size_t N3, V, K;
+    int d;
+    if (nrhs != 10 || !mxIsDouble(prhs[2]) || mxGetNumberOfElements(prhs[2]) != 9)
+        mexErrMsgIdAndTxt("FGG_Plan3D:layout",
+                "Use FGG_Plan3D('crop'/'pad',data,[M_r offset N],E_4x,E_4y,E_4z,scale,ox,oy,oz).");
+    geometry = mxGetDoubles(prhs[2]);
+    for (d = 0; d < 3; d++)
+    {
+        job.M_r[d] = (int)geometry[d];
+        job.offset[d] = (int)geometry[3+d];
+        job.N[d] = (int)geometry[6+d];
+        if (job.offset[d] < 0 || job.offset[d]+job.N[d] > job.M_r[d])
+            mexErrMsgIdAndTxt("FGG_Plan3D:layout", "The image must lie inside the grid.");
+        if (!mxIsDouble(prhs[3+d]) || mxIsComplex(prhs[3+d])
+                || mxGetNumberOfElements(prhs[3+d]) != (size_t)job.N[d]
+                || !mxIsDouble(prhs[7+d]) || mxIsComplex(prhs[7+d])
+                || mxGetNumberOfElements(prhs[7+d]) != (size_t)job.N[d])
+            mexErrMsgIdAndTxt("FGG_Plan3D:layout", "E_4 and the layout need N(d) real values per axis.");
+        job.E_4[d] = mxGetDoubles(prhs[3+d]);
+        job.layout[d] = mxGetDoubles(prhs[7+d]);
+    }
+    job.scale = mxGetScalar(prhs[6]);
+    job.in = inputData(prhs[1], &job.inIsComplex);
+    N3 = (size_t)job.M_r[0]*job.M_r[1]*job.M_r[2];
+    V = (size_t)job.N[0]*job.N[1]*job.N[2];
+    K = mxGetNumberOfElements(prhs[1])/(crop ? N3 : V);
+    if (K == 0 || mxGetNumberOfElements(prhs[1]) != K*(crop ? N3 : V))
+        mexErrMsgIdAndTxt("FGG_Plan3D:layout", crop ? "F_tau must have M_r(1)*M_r(2)*M_r(3) values (per column)."
+                : "x must have N(1)*N(2)*N(3) values (per column).");
+    plhs[0] = mxCreateUninitNumericMatrix(crop ? V : N3, K, mxDOUBLE_CLASS, mxCOMPLEX);
+    job.out = (double *)mxGetComplexDoubles(plhs[0]);
+    if (crop)
+        parallelFor(K*job.N[2], 1, cropBody, &job);
+    else
+    {
+        adviseHugePages(job.out, 2*N3*K*sizeof(double));
+        parallelFor(K*job.M_r[2], 0, padBody, &job);
+    }
+}
+
+static void fggAtExit(void)
+{
+    freeAllPlans();
+#ifdef FGG_POOL
+    poolStop();
+#endif
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    char command[16];
+    FGGPlan3D *plan;
+    const double *in;
+    double *out;
+    int isComplex, T, K, c;
+    size_t N3, inColumn;
+    mexAtExit(fggAtExit);
+    if (nrhs < 1 || !mxIsChar(prhs[0]) || mxGetString(prhs[0], command, sizeof(command)))
+        mexErrMsgIdAndTxt("FGG_Plan3D:command",
+                "The first input must be 'create', 'createrays', 'type1', 'type2', 'materialize', 'separable', 'crop', 'pad', 'threading' or 'destroy'.");
+    if (strcmp(command, "create") == 0 || strcmp(command, "createrays") == 0)
+    {
+        plan = command[6] == 0 ? createPlan(nrhs, prhs) : createRayPlan(nrhs, prhs);
+        plhs[0] = mxCreateNumericMatrix(1, 1, mxUINT64_CLASS, mxREAL);
+        *(uint64_t *)mxGetData(plhs[0]) = (uint64_t)(uintptr_t)plan;
+        return;
+    }
+    if (strcmp(command, "threading") == 0)
+    {
+        if (nrhs > 1 && mxGetScalar(prhs[1]) >= 1)
+        {
+#ifdef FGG_POOL
+            poolStop();
+            poolStart((int)mxGetScalar(prhs[1]));
+#elif defined(_OPENMP)
+            omp_set_num_threads((int)mxGetScalar(prhs[1]));
+#endif
+        }
+        fggHugePages = nrhs > 2 && mxGetScalar(prhs[2]) != 0;
+        if (nrhs < 4 || !mxIsChar(prhs[3]) || mxGetString(prhs[3], command, sizeof(command)))
+            strcpy(command, "none");
+        if (strcmp(command, "none") == 0)
+            fggPinning = FGG_PIN_NONE;
+        else if (strcmp(command, "close") == 0)
+            fggPinning = FGG_PIN_CLOSE;
+        else if (strcmp(command, "spread") == 0)
+            fggPinning = FGG_PIN_SPREAD;
+        else
+            mexErrMsgIdAndTxt("FGG_Plan3D:threading", "The pinning must be 'none', 'close' or 'spread'.");
+        pinThreads();
+        return;
+    }
+    if (strcmp(command, "crop") == 0 || strcmp(command, "pad") == 0)
+    {
+        layoutTransform(command[0] == 'c', nlhs, plhs, nrhs, prhs);
+        return;
+    }
+    if (nrhs < 2)
+        mexErrMsgIdAndTxt("FGG_Plan3D:command", "Missing plan handle.");
+    if (strcmp(command, "destroy") == 0)
+    {
+        destroyPlan(prhs[1]);
+        return;
+    }
+    plan = getPlan(prhs[1]);
+    if (strcmp(command, "separable") == 0)
+    {
+        if (nrhs < 3 || !mxIsChar(prhs[2]) || mxGetString(prhs[2], command, sizeof(command)))
+            command[0] = 0;
+        if (strcmp(command, "double") == 0)
+            storeSeparable(plan, FGG_WEIGHTS_DOUBLE);
+        else if (strcmp(command, "single") == 0)
+            storeSeparable(plan, FGG_WEIGHTS_SINGLE);
+        else if (strcmp(command, "bfloat16") == 0)
+            storeSeparable(plan, FGG_WEIGHTS_BFLOAT16);
+        else if (strcmp(command, "half") == 0)
+            storeSeparable(plan, FGG_WEIGHTS_HALF);
+        else
+            mexErrMsgIdAndTxt("FGG_Plan3D:separable",
+                    "The weight class must be 'double', 'single', 'bfloat16' or 'half'.");
+        return;
+    }
+    if (strcmp(command, "materialize") == 0)
+    {
+        plhs[0] = mxCreateLogicalScalar(materializePlan(plan,
+                nrhs > 2 ? mxGetScalar(prhs[2]) : -1) != 0);
+        return;
+    }
+    N3 = (size_t)plan->M_r[0]*plan->M_r[1]*plan->M_r[2];
+    if (nrhs < 3)
+        mexErrMsgIdAndTxt("FGG_Plan3D:command", "Missing data input.");
+    in = inputData(prhs[2], &isComplex);
+    /*z slabs need at least one plane per thread*/
+    T = numThreads() < plan->M_r[2] ? numThreads() : plan->M_r[2];
+    if (!plan->isMatrix && T > 1)
+        planeBuckets(plan);
+    if (strcmp(command, "type1") == 0)
+    {
+        if (mxGetNumberOfElements(prhs[2]) == 0 || mxGetNumberOfElements(prhs[2])%plan->M)
+            mexErrMsgIdAndTxt("FGG_Plan3D:input", "f must have one value per knot (per column).");
+        K = (int)(mxGetNumberOfElements(prhs[2])/plan->M);
+        /*uninitialized, so that the grid is first touched by the threads
+        that work on it*/
+        plhs[0] = mxCreateUninitNumericMatrix(N3, K, mxDOUBLE_CLASS, mxCOMPLEX);
+        out = (double *)mxGetComplexDoubles(plhs[0]);
+        adviseHugePages(out, 2*N3*K*sizeof(double));
+        inColumn = (isComplex ? 2 : 1)*plan->M;
+        if (!plan->isMatrix && T > 1)
+            slabTransform(plan, 1, in, isComplex, inColumn, out, 2*N3, T, K);
+        else
+            for (c = 0; c < K; c++)
+                if (plan->isMatrix)
+                    spreadMatrix(plan, in+c*inColumn, isComplex, out+2*N3*c);
+                else
+                    spread(plan, in+c*inColumn, isComplex, out+2*N3*c);
+    }
+    else if (strcmp(command, "type2") == 0)
+    {
+        if (mxGetNumberOfElements(prhs[2]) == 0 || mxGetNumberOfElements(prhs[2])%N3)
+            mexErrMsgIdAndTxt("FGG_Plan3D:input",
+                    "f_tau must have M_r(1)*M_r(2)*M_r(3) values (per column).");
+        K = (int)(mxGetNumberOfElements(prhs[2])/N3);
+        plhs[0] = mxCreateUninitNumericMatrix(plan->M, K, mxDOUBLE_CLASS, mxCOMPLEX);
+        out = (double *)mxGetComplexDoubles(plhs[0]);
+        inColumn = (isComplex ? 2 : 1)*N3;
+        if (!plan->isMatrix && T > 1)
+            slabTransform(plan, 0, in, isComplex, inColumn, out, 2*plan->M, T, K);
+        else
+            for (c = 0; c < K; c++)
+                if (plan->isMatrix)
+                    interpMatrix(plan, in+c*inColumn, isComplex, out+2*plan->M*c);
+                else
+                    interp(plan, in+c*inColumn, isComplex, out+2*plan->M*c);
+    }
+    else
+        mexErrMsgIdAndTxt("FGG_Plan3D:command", "Unknown command '%s'.", command);
+}
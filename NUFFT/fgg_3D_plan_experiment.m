@@ -0,0 +1,188 @@
+%test script fgg_3D_plan_experiment.m for the persistent 3D NUFFT plans
+%(FGG_3d_plan.m, FGG_3d_type1plan.m, iFGG_3d_type2plan.m), the type-3
+%NUFFT (FGG_3d_type3plan.m), the autotuner and the density compensation.
+%
+%NOTE: the C files "FGG_Plan3D.c", "FGG_Convolution3D.c" and
+%"FGG_Convolution3D_type2.c" must be compiled into Matlab executables:
+%mex -R2018a FGG_Plan3D.c
+%mex FGG_Convolution3D.c
+%mex FGG_Convolution3D_type2.c
+
+clear all;
+close all;
+
+N=[32,32,16];
+M=20000;
+Desired_accuracy = 6;%6=single precision, 12=double precision.
+%Voxel-grid frequencies as in JointSparseRecovery_3D.m
+GridListx=linspace(-1/2,1/2,N(1)+1);
+GridListy=linspace(-1/2,1/2,N(2)+1);
+GridListz=linspace(-1/2,1/2,N(3)+1);
+knots=rand(M,3)-1/2;
+f=randn(M,1)+sqrt(-1)*randn(M,1);
+F=randn(N)+sqrt(-1)*randn(N);
+
+tic
+plan=FGG_3d_plan(knots,N,Desired_accuracy,GridListx,GridListy,GridListz);
+disp(['Plan created in ',num2str(toc),' seconds'])
+
+tic
+F_mod=FGG_3d_type1mod(f,knots,N,Desired_accuracy,GridListx,GridListy,GridListz);
+disp(['Type-I without plan: ',num2str(toc),' seconds'])
+tic
+F_plan=FGG_3d_type1plan(f,plan);
+disp(['Type-I with plan: ',num2str(toc),' seconds'])
+Type1_difference=norm(F_plan(:)-F_mod(:))/norm(F_mod(:))
+
+tic
+f_mod=iFGG_3d_type2mod(F,knots,Desired_accuracy,GridListx,GridListy,GridListz);
+disp(['Type-II without plan: ',num2str(toc),' seconds'])
+tic
+f_plan=iFGG_3d_type2plan(F,plan);
+disp(['Type-II with plan: ',num2str(toc),' seconds'])
+Type2_difference=norm(f_plan-f_mod)/norm(f_mod)
+
+%The operator used by JointSparseRecovery_3D.m must be an exact adjoint pair
+x=randn(prod(N),1)+sqrt(-1)*randn(prod(N),1);
+Adjoint_error=abs(f'*sar_operator_nufft_3d_plan(x,1,plan)-...
+    sar_operator_nufft_3d_plan(f,2,plan)'*x)/abs(f'*sar_operator_nufft_3d_plan(x,1,plan))
+
+%Voxel layouts (voxelLayout.m): the MEX function crops and pads straight
+%into the order of the layout, which must agree with the permuted volume
+for layoutCase={{'zxy',[1 1 1]},{'xyz',[1 1 1]},{'yzx',[4 8 2]}}
+    layout=voxelLayout(N,layoutCase{1}{:});
+    [ix,iy,iz]=ndgrid(1:N(1),1:N(2),1:N(3));
+    idx=voxelLayoutIndex(layout,ix,iy,iz);
+    [jx,jy,jz]=voxelLayoutSubscripts(layout,idx);
+    Layout_subscript_error=max(abs([jx(:)-ix(:);jy(:)-iy(:);jz(:)-iz(:)]))
+    F_layout=FGG_3d_type1plan(f,plan,layout);
+    Layout_type1_error=norm(F_layout(idx(:))-F_plan(:))/norm(F_plan(:))
+    xLayout=zeros(prod(N),1);
+    xLayout(idx(:))=F(:);
+    Layout_type2_error=norm(iFGG_3d_type2plan(xLayout,plan,layout)-f_plan)/norm(f_plan)
+end
+
+FGG_3d_planDestroy(plan);
+
+%Matrix mode: the gridding is stored once as a sparse matrix with float
+%weights, so the difference is at the single precision level
+plan=FGG_3d_plan(knots,N,Desired_accuracy,GridListx,GridListy,GridListz,'onthefly');
+matrixPlan=FGG_3d_plan(knots,N,Desired_accuracy,GridListx,GridListy,GridListz,'matrix');
+tic
+F_plan=FGG_3d_type1plan(f,plan);
+disp(['Type-I on the fly: ',num2str(toc),' seconds'])
+tic
+F_matrix=FGG_3d_type1plan(f,matrixPlan);
+disp(['Type-I with the matrix: ',num2str(toc),' seconds'])
+Matrix_difference=norm(F_matrix(:)-F_plan(:))/norm(F_plan(:))
+%Separable weights in reduced precision
+for weightClass={'double','single','bfloat16','half'}
+    separablePlan=FGG_3d_plan(knots,N,Desired_accuracy,GridListx,GridListy,...
+        GridListz,'separable',weightClass{1});
+    tic
+    F_separable=FGG_3d_type1plan(f,separablePlan);
+    disp(['Type-I with ',weightClass{1},' separable weights: ',num2str(toc),...
+        ' seconds, relative difference ',...
+        num2str(norm(F_separable(:)-F_plan(:))/norm(F_plan(:)))])
+    FGG_3d_planDestroy(separablePlan);
+end
+FGG_3d_planDestroy(plan);
+FGG_3d_planDestroy(matrixPlan);
+
+%Tabulated Gaussian against the E_2 recurrence: accuracy and speed of the
+%gridding for a low and a high accuracy kernel
+for accuracy=[6 12]
+    for kernel={'recurrence','linear','cubic'}
+        kernelPlan=FGG_3d_plan(knots,N,accuracy,GridListx,GridListy,GridListz,...
+            'onthefly','double',kernel{1});
+        tic
+        F_kernel=FGG_3d_type1plan(f,kernelPlan);
+        f_kernel=iFGG_3d_type2plan(F,kernelPlan);
+        t=toc;
+        if strcmp(kernel{1},'recurrence')
+            F_ref=F_kernel; f_ref=f_kernel;
+        end
+        disp(['M_sp=',num2str(accuracy),', ',kernel{1},' kernel: ',num2str(t),...
+            ' seconds, relative difference ',...
+            num2str(norm(F_kernel(:)-F_ref(:))/norm(F_ref(:))),' (type-I), ',...
+            num2str(norm(f_kernel-f_ref)/norm(f_ref)),' (type-II)'])
+        FGG_3d_planDestroy(kernelPlan);
+    end
+end
+
+%Anisotropic kernels: fewer digits along z, and a larger oversampling
+%along z so that the kernel can be shorter still, against the 12-digit
+%reference of the mod routine
+F_ref=FGG_3d_type1mod(f,knots,N,12,GridListx,GridListy,GridListz);
+for setting={{6,2},{[6 6 4],2},{[6 6 6],[2 2 3]}}
+    anisoPlan=FGG_3d_plan(knots,N,setting{1},GridListx,GridListy,GridListz,...
+        'onthefly','double','recurrence',setting{2});
+    tic
+    F_aniso=FGG_3d_type1plan(f,anisoPlan);
+    t=toc;
+    disp(['accuracy [',num2str(setting{1}),'], R [',num2str(setting{2}),...
+        ']: footprint ',num2str(prod(2*anisoPlan.M_sp)),', ',num2str(t),...
+        ' seconds, error ',num2str(norm(F_aniso(:)-F_ref(:))/norm(F_ref(:))),...
+        ' (estimate ',num2str(anisoPlan.errorEstimate),')'])
+    FGG_3d_planDestroy(anisoPlan);
+end
+
+%Line-structured knots: P rays of K equally spaced knots, as the pulses of
+%a polar-format SAR collection
+P=100; K=200;
+rays.start=rand(P,3)-1/2;
+rays.step=(rand(P,3)-1/2)/K;
+rays.length=K;
+j=kron(ones(P,1),(0:K-1).');
+knotsRay=kron(rays.start,ones(K,1))+j.*kron(rays.step,ones(K,1));
+fRay=randn(P*K,1)+sqrt(-1)*randn(P*K,1);
+tic
+rayPlan=FGG_3d_plan(rays,N,Desired_accuracy,GridListx,GridListy,GridListz);
+F_ray=FGG_3d_type1plan(fRay,rayPlan);
+disp(['Type-I with ray plan: ',num2str(toc),' seconds'])
+F_mod=FGG_3d_type1mod(fRay,knotsRay,N,Desired_accuracy,GridListx,GridListy,GridListz);
+Ray_difference=norm(F_ray(:)-F_mod(:))/norm(F_mod(:))
+FGG_3d_planDestroy(rayPlan);
+
+%Type-3 NUFFT on a sparse voxel list: against the grid operator with the
+%other voxels set to zero, and against the direct sum
+S=find(rand(N)<0.01);
+[i1,i2,i3]=ind2sub(N,S);
+Res=-1./(2*[min(GridListx) min(GridListy) min(GridListz)]);
+targets=([i1 i2 i3]-1-N/2).*Res;
+tic
+type3Plan=FGG_3d_type3plan(knots,targets,Desired_accuracy);
+f_type3=iFGG_3d_type3(F(S),type3Plan);
+F_type3=FGG_3d_type3(f,type3Plan);
+disp(['Type-3 plan and transforms for ',num2str(numel(S)),' voxels: ',num2str(toc),' seconds'])
+F_sparse=zeros(N); F_sparse(S)=F(S);
+plan=FGG_3d_plan(knots,N,Desired_accuracy,GridListx,GridListy,GridListz);
+f_grid=iFGG_3d_type2plan(F_sparse,plan);
+FGG_3d_planDestroy(plan);
+Type3_grid_difference=norm(f_type3-f_grid)/norm(f_grid)
+f_direct=exp(1i*2*pi*knots*targets.')*F(S)/M;
+Type3_direct_difference=norm(f_type3-f_direct)/norm(f_direct)
+F_direct=exp(-1i*2*pi*targets*knots.')*f/M;
+Type3_adjoint_direct_difference=norm(F_type3-F_direct)/norm(F_direct)
+FGG_3d_planDestroy(type3Plan);
+
+%Autotuned plan: the first call times the candidates, the second one reads
+%the choice from the tuning cache
+for pass=1:2
+    tic
+    tunedPlan=FGG_3d_plan(knots,N,Desired_accuracy,GridListx,GridListy,GridListz,'tune');
+    disp(['Tuned plan (pass ',num2str(pass),') created in ',num2str(toc),' seconds'])
+    F_tuned=FGG_3d_type1plan(f,tunedPlan);
+    Tuned_error=norm(F_tuned(:)-F_ref(:))/norm(F_ref(:))
+    FGG_3d_planDestroy(tunedPlan);
+end
+
+%Density compensation (FGG_3d_densityComp.m) of knots that are four times
+%denser near the origin: at the fixed point the gridded weights are flat
+knotsDense=[knots;(rand(M,3)-1/2)/4];
+plan=FGG_3d_plan(knotsDense,N,Desired_accuracy,GridListx,GridListy,GridListz);
+w=FGG_3d_densityComp(plan,20);
+gridded=real(FGG_Plan3D('type2',plan.handle,FGG_Plan3D('type1',plan.handle,w)));
+Density_spread=std(gridded)/mean(gridded)
+Density_weight_ratio=mean(w(M+1:end))/mean(w(1:M))
+FGG_3d_planDestroy(plan);
@@ -0,0 +1,43 @@
+function  f = iFGG_3d_type2plan(F,plan,layout)
+%Description:
+%Type-II (uniform --> nonuniform) 3D NUFFT with a plan from FGG_3d_plan.m.
+%Same result as iFGG_3d_type2mod(F,knots,accuracy,GridListx,GridListy,
+%GridListz) for the knots, accuracy and grid of the plan.
+%
+%Inputs:
+%       F: the 3D matrix of time-domain data, with dimension [Nx, Ny, Nz],
+%           or K of them as an [Nx, Ny, Nz, K] array, which are
+%           interpolated concurrently (FGG_Plan3D splits its threads
+%           between them)
+%       plan: the plan returned by FGG_3d_plan.m
+%       layout: (optional) voxel layout from voxelLayout.m; F is then a
+%           prod(N)xK matrix in that order, which the MEX function
+%           deconvolves and pads straight into the oversampled grid ('pad')
+%Outputs:
+%       f: frequency-domain data at the knots of the plan (complex Mx1,
+%           or MxK)
+
+N=plan.N;
+%Deconvolve and zero pad for convolution on the finer mesh
+if nargin > 2
+    K=size(F,2);
+    padF=reshape(FGG_Plan3D('pad',F,[plan.M_r plan.offset N],plan.E_4x,plan.E_4y,plan.E_4z,...
+        1/plan.M,layout.offset{:}),[plan.M_r K]);
+else
+    K=size(F,4);
+    padF=zeros([plan.M_r K]);
+    padF(plan.offset(1)+(1:N(1)),plan.offset(2)+(1:N(2)),plan.offset(3)+(1:N(3)),:) = ...
+        F.*plan.E_4x.*plan.E_4y.*plan.E_4z/plan.M;
+end
+if K==1
+    f_tau = fftshift(ifftn(ifftshift(padF)));
+else
+    %3D inverse FFT of every grid (ifftn would also transform across them)
+    f_tau = padF;
+    for d=1:3
+        f_tau = fftshift(ifft(ifftshift(f_tau,d),[],d),d);
+    end
+end
+clear padF;
+%Interpolation: the grid is read in place by the MEX function
+f = FGG_Plan3D('type2',plan.handle,f_tau);
@@ -0,0 +1,16 @@
+function  f = iFGG_3d_type3(F,plan)
+%Description:
+%Type-3 3D NUFFT from the target points of a plan from FGG_3d_type3plan.m
+%to its k-space knots,
+%    f(j) = 1/M sum_k F(k) exp(i*2*pi*knots(j,:)*targets(k,:).').
+%
+%Inputs:
+%       F: values at the targets (Kx1)
+%       plan: the plan returned by FGG_3d_type3plan.m
+%Outputs:
+%       f: frequency-domain data at the knots (complex Mx1)
+
+%Spread the (phase-shifted) targets onto the inner grid
+G=reshape(FGG_Plan3D('type1',plan.spreadHandle,plan.pre.*F(:)),plan.Ng);
+%Evaluate the gridded sum at the knots and divide out the Gaussian
+f=plan.post.*iFGG_3d_type2plan(G,plan.kPlan);
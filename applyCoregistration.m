@@ -0,0 +1,25 @@
+%% Applies the coregistration of coregisterPasses.m to an image
+% Returns image(r + shift).*exp(-1i*(phase + gradient*[x; y])), with the
+% subpixel shift applied as a phase ramp on the 2D FFT of the image and
+% x, y the pixel coordinates from pixel floor(n/2)+1.
+% inputs
+% image - complex image (nx x ny)
+% shift - [dx dy] shift in pixels
+% phase - phase (rad) at the origin
+% gradient - [gx gy] phase gradient (rad/pixel)
+% outputs
+% image - corrected image
+
+function image = applyCoregistration(image,shift,phase,gradient)
+
+[nx,ny] = size(image);
+fx = ifftshift(-floor(nx/2):ceil(nx/2)-1).'/nx;
+fy = ifftshift(-floor(ny/2):ceil(ny/2)-1)/ny;
+if any(shift)
+    image = ifft2(fft2(image).*exp(1i*2*pi*(fx*shift(1) + fy*shift(2))));
+end
+x = (1:nx).' - (floor(nx/2)+1);
+y = (1:ny) - (floor(ny/2)+1);
+image = image.*exp(-1i*(phase + gradient(1)*x + gradient(2)*y));
+
+end
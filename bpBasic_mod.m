@@ -77,22 +77,11 @@ for ii = 1:data.Np
     end
     tic
 
-    % Form the range profile with zero padding added
-    rc = fftshift(ifft(data.phdata(:,ii),data.Nfft));
-
-    % Calculate differential range for each pixel in the image (m)
-    dR = sqrt((data.AntX(ii)-data.x_mat).^2 + ...
-        (data.AntY(ii)-data.y_mat).^2 + ...
-        (data.AntZ(ii)-data.z_mat).^2) - data.R0(ii);
-
-    % Calculate phase correction for image
-    phCorr = exp(1i*4*pi*data.minF(ii)/c*dR);
-
-    % Determine which pixels fall within the range swath
-    I = find(and(dR > min(data.r_vec), dR < max(data.r_vec)));
-
-    % Update the image using linear interpolation
-    data.im_final(I) = data.im_final(I) + interp1(data.r_vec,rc,dR(I),'linear') .* phCorr(I);
+    % Backproject the pulse and update the image
+    [pulseImage,I] = bpPulse(data.phdata(:,ii),data.AntX(ii),data.AntY(ii),...
+        data.AntZ(ii),data.R0(ii),data.minF(ii),data.r_vec,data.Nfft,...
+        data.x_mat,data.y_mat,data.z_mat);
+    data.im_final(I) = data.im_final(I) + pulseImage;
     
     % Determine the execution time for this pulse
     t(ii) = toc;
@@ -0,0 +1,42 @@
+function [pulseImage,I] = bpPulse(phdata,AntX,AntY,AntZ,R0,minF,r_vec,Nfft,x_mat,y_mat,z_mat)
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+% This function backprojects a single pulse.  It is the loop body of   %
+% bpBasic_mod, split out so that images can be updated one pulse at a  %
+% time (streaming and sliding-aperture image formation).               %
+%                                                                      %
+% phdata:  Phase history of the pulse (frequency domain, column)       %
+% AntX, AntY, AntZ:  Position of the sensor for the pulse (m)          %
+% R0:  The range to scene center for the pulse (m)                     %
+% minF:  The start frequency of the pulse (Hz)                         %
+% r_vec:  Range to every bin in the range profile (m)                  %
+% Nfft:  Size of the FFT to form the range profile                     %
+% x_mat, y_mat, z_mat:  The position of each pixel (m)                 %
+%                                                                      %
+% The output is:                                                       %
+% pulseImage:  The contribution of the pulse to the pixels I, i.e.     %
+%              im_final(I) = im_final(I) + pulseImage adds the pulse   %
+%              and im_final(I) = im_final(I) - pulseImage removes it   %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+% Define speed of light (m/s)
+c = 299792458;
+
+% Form the range profile with zero padding added
+rc = fftshift(ifft(phdata,Nfft));
+
+% Calculate differential range for each pixel in the image (m)
+dR = sqrt((AntX-x_mat).^2 + ...
+    (AntY-y_mat).^2 + ...
+    (AntZ-z_mat).^2) - R0;
+
+% Calculate phase correction for image
+phCorr = exp(1i*4*pi*minF/c*dR);
+
+% Determine which pixels fall within the range swath
+I = find(and(dR > min(r_vec), dR < max(r_vec)));
+
+% Linear interpolation of the range profile at the pixel ranges
+pulseImage = interp1(r_vec,rc,dR(I),'linear') .* phCorr(I);
+
+return
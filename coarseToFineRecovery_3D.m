@@ -0,0 +1,134 @@
+%% Coarse-to-fine joint sparse recovery of the 3D reflectivity
+% Solves the group-sparse problem of JointSparseRecovery_3D.m first on a
+% voxel grid downsampled by factor along every axis, where the NUFFTs are
+% about factor^3 times cheaper, and then on the fine grid restricted to the
+% neighbourhood of the occupied z-columns and height bands of the coarse
+% solution. The coarse voxels are the fine voxels with indices
+% 1, factor+1, 2*factor+1, ..., so the coarse operator is the fine operator
+% restricted to them and the coarse solution is prolongated exactly by
+% injection. It warm-starts the fine solve, which only has the support
+% neighbourhood as unknowns.
+%
+% inputs
+% A1 - fine operator, @(x,mode) as for SPGL1 (sar_operator_nufft_3d_plan.m
+%      or, with weights, sar_operator_weighted.m)
+% b - measurements (multiplied by sqrtW)
+% groups - group (z-column) of every fine voxel, in the order of layout
+% sigma - bound on the norm of the residual
+% options - SPGL1 options (spgSetParms), or the options of spgGroupPareto.m
+%           to solve with it instead
+% knots - knots of the fine NUFFT plan, as given to FGG_3d_plan.m
+% M - [M_x M_y M_z] fine voxel grid (multiples of 2*factor)
+% accuracy, mode - accuracy and mode of the NUFFT plans (FGG_3d_plan.m)
+% gridLists - {GridListx,GridListy,GridListz} of the fine NUFFT plan
+% factor - downsampling factor of the coarse grid, e.g. 2 or 4
+% supportDb - coarse voxels within supportDb dB of the maximum of the
+%             coarse solution are occupied
+% margin - number of coarse voxels added around the occupied voxels, in x,
+%          y and z
+% sqrtW - (optional) square roots of the weights of the measurements that
+%         precondition A1 (sar_operator_weighted.m), applied to the coarse
+%         operator as well (default 1)
+% layout - (optional) voxel layout of the fine solution and of A1
+%          (voxelLayout.m), default z fastest, then x, then y; the coarse
+%          solve keeps that default
+% outputs
+% x - fine solution (zero outside the support)
+% info - struct with the coarse solution xCoarse, the fine support indices
+%        support and the SPGL1 info of both solves
+
+function [x,info] = coarseToFineRecovery_3D(A1,b,groups,sigma,options,knots,M,...
+    accuracy,mode,gridLists,factor,supportDb,margin,sqrtW,layout)
+
+if nargin < 14 || isempty(sqrtW)
+    sqrtW = 1;
+end
+M = M(:).';
+if nargin < 15
+    layout = voxelLayout(M,'zxy');
+end
+if any(mod(M,2*factor))
+    error('coarseToFineRecovery_3D:grid','The grid %s is not a multiple of 2*%d.',...
+        mat2str(M),factor);
+end
+Mc = M/factor;
+numVoxels = prod(M);
+usePareto = isfield(options,'paretoPoints');
+
+%% coarse solve: same knots and measurements, grid spacing factor times larger
+coarsePlan = FGG_3d_plan(knots,Mc,accuracy,gridLists{1}/factor,...
+    gridLists{2}/factor,gridLists{3}/factor,mode);
+Ac = @(x,mode)sar_operator_weighted(x,mode,...
+    @(v,m)sar_operator_nufft_3d_plan(v,m,coarsePlan),sqrtW);
+% voxels ordered z fastest, then x, then y, one group per z-column
+groupsCoarse = reshape(repmat(1:Mc(1)*Mc(2),Mc(3),1),[],1);
+if usePareto
+    [xCoarse,~,info.coarse] = spgGroupPareto(Ac,b,groupsCoarse,sigma,options);
+else
+    [xCoarse,~,~,info.coarse] = spg_group(Ac,b,groupsCoarse,sigma,options);
+end
+FGG_3d_planDestroy(coarsePlan);
+xCoarse = reshape(xCoarse,Mc(3),Mc(1),Mc(2));
+info.xCoarse = xCoarse;
+
+%% support: occupied voxels, filled over the height band of every column
+% and dilated by margin
+magnitude = abs(xCoarse);
+occupied = magnitude > max(magnitude(:))*10^(-supportDb/20);
+band = cumsum(occupied,1) > 0 & flip(cumsum(flip(occupied,1),1) > 0,1);
+box = ones(2*margin+1,2*margin+1,2*margin+1);
+band = convn(double(band),box,'same') > 0;
+
+% a fine voxel belongs to the coarse voxel nearest to it (periodically)
+nearest = @(n,f) mod(round((0:n-1)/f),n/f)+1;
+supportMask = band(nearest(M(3),factor),nearest(M(1),factor),nearest(M(2),factor));
+[iz,ix,iy] = ind2sub(M([3 1 2]),find(supportMask(:)));
+clear supportMask;
+info.support = sort(voxelLayoutIndex(layout,ix,iy,iz));
+clear iz ix iy;
+numSupport = length(info.support);
+fprintf('Coarse-to-fine: %d of %d coarse columns occupied, %d of %d fine voxels (%.2f%%) in the support\n',...
+    nnz(any(band,1)),Mc(1)*Mc(2),numSupport,numVoxels,100*numSupport/numVoxels);
+if numSupport == 0 && usePareto
+    [x,~,info.fine] = spgGroupPareto(A1,b,groups,sigma,options);
+    return;
+elseif numSupport == 0
+    [x,~,~,info.fine] = spg_group(A1,b,groups,sigma,options);
+    return;
+end
+
+%% prolongation by injection of the coarse solution into the support
+nonzero = find(xCoarse);
+[iz,ix,iy] = ind2sub(Mc([3 1 2]),nonzero);
+injected = voxelLayoutIndex(layout,factor*(ix-1)+1,factor*(iy-1)+1,factor*(iz-1)+1);
+[inSupport,position] = ismember(injected,info.support);
+x0 = zeros(numSupport,1);
+x0(position(inSupport)) = xCoarse(nonzero(inSupport));
+
+%% fine solve restricted to the support, warm-started at the prolongated
+% solution (SPGL1 starts its root finding at tau = norm of x0)
+As = @(x,mode)restrictedOperator(x,mode,A1,info.support,numVoxels);
+if usePareto
+    [xs,~,info.fine] = spgGroupPareto(As,b,groups(info.support),sigma,options,x0);
+else
+    options = spgGroupOptions(options,groups(info.support));
+    [xs,~,~,info.fine] = spgl1(As,b,options.primal_norm(x0,1),sigma,x0,options);
+end
+
+x = zeros(numVoxels,1);
+x(info.support) = xs;
+
+end
+
+%% Fine operator applied to the voxels of the support only (to every column
+% of x)
+function y = restrictedOperator(x,mode,A1,support,numVoxels)
+if mode == 1
+    xFull = zeros(numVoxels,size(x,2));
+    xFull(support,:) = x;
+    y = A1(xFull,1);
+else
+    y = A1(x,2);
+    y = y(support,:);
+end
+end
@@ -0,0 +1,149 @@
+%% Coregistration and phase calibration of the pass images
+% Estimates, for every pass, the subpixel shift and the residual phase
+% screen relative to a reference pass. Both are estimated from the FFT
+% cross-correlation of tiles of the images. All tiles of a pass are
+% stacked as the pages of one array, so the FFTs of all tiles run in one
+% call.
+%
+% For each tile:
+%   - the peak of the correlation gives the integer shift;
+%   - a parabola through the peak and its neighbours refines it to a
+%     fraction of a pixel;
+%   - the complex peak value gives the residual phase of the tile;
+%   - its normalized magnitude gives the coherence of the tile.
+% Tiles below minCoherence are dropped. The shift of the pass is the
+% coherence-weighted mean of the tile shifts within one pixel of their
+% median. The phase screen is fitted to the coherence-weighted phasors of
+% the tiles without unwrapping:
+%   - constant: the phase of their sum;
+%   - plane: the frequency that maximizes the sum demodulated by a linear
+%     phase (zero-padded FFT over the tile grid), then the phase of that
+%     sum.
+% A screen with more freedom would also absorb the heights of the
+% scatterers, which are the signal of the 3D recovery.
+%
+% With pass = the reference shifted by shift and multiplied by
+% exp(1i*(phase + gradient*[x; y])), the corrected pass is
+%     pass(r + shift).*exp(-1i*(phase + gradient*[x; y])),
+% where x, y are pixel coordinates from pixel floor(n/2)+1.
+% JointSparseRecovery_3D.m applies this while sampling the phase history:
+%   - the shift as a phase ramp;
+%   - the gradient as an offset of the knots of the type-2 NUFFT.
+% applyCoregistration.m applies it in the image domain.
+% inputs
+% images - 1 x P cell array of complex images of the same size (nx x ny)
+% reference - index of the reference pass
+% opts - (optional) struct with the fields
+%       tileSize - side of the square tiles in pixels (default 128)
+%       minCoherence - tiles with a lower coherence are ignored (default
+%               0.3)
+%       phaseModel - 'constant', 'plane' or 'none' (default 'constant')
+% outputs
+% shift - P x 2 shifts [dx dy] in pixels (zero for the reference)
+% phase - P x 1 phases (rad) at the origin
+% gradient - P x 2 phase gradients [gx gy] (rad/pixel)
+% info - struct with the tile centres and, per pass, the tile shifts,
+%        phases and coherences
+
+function [shift,phase,gradient,info] = coregisterPasses(images,reference,opts)
+
+if nargin < 3
+    opts = struct();
+end
+defaults = struct('tileSize',128,'minCoherence',0.3,'phaseModel','constant');
+names = fieldnames(defaults);
+for i=1:length(names)
+    if ~isfield(opts,names{i})
+        opts.(names{i}) = defaults.(names{i});
+    end
+end
+P = length(images);
+[nx,ny] = size(images{1});
+T = min([opts.tileSize nx ny]);
+numTiles = floor([nx ny]/T);
+% tile centres relative to the origin pixel
+[cx,cy] = ndgrid((0:numTiles(1)-1)*T + T/2 + 1 - (floor(nx/2)+1),...
+    (0:numTiles(2)-1)*T + T/2 + 1 - (floor(ny/2)+1));
+info.centres = [cx(:) cy(:)];
+% Hann taper against the wrap-around of the tile edges
+taper = 0.5 - 0.5*cos(2*pi*(0:T-1).'/(T-1));
+taper = taper*taper.';
+lag = ifftshift(-floor(T/2):ceil(T/2)-1).';
+
+refTiles = tiles(images{reference},T,numTiles,taper);
+refEnergy = squeeze(sum(sum(abs(refTiles).^2,1),2));
+Fref = fft2(refTiles);
+clear refTiles;
+
+shift = zeros(P,2);
+phase = zeros(P,1);
+gradient = zeros(P,2);
+info.tileShift = cell(1,P);
+info.tilePhase = cell(1,P);
+info.coherence = cell(1,P);
+for p = 1:P
+    if p == reference
+        continue;
+    end
+    passTiles = tiles(images{p},T,numTiles,taper);
+    passEnergy = squeeze(sum(sum(abs(passTiles).^2,1),2));
+    xc = ifft2(fft2(passTiles).*conj(Fref));
+    clear passTiles;
+    [peakAbs,peak] = max(reshape(abs(xc),T*T,[]),[],1);
+    [px,py] = ind2sub([T T],peak(:));
+    page = (0:size(xc,3)-1).'*T*T;
+    peakValue = xc(px + (py-1)*T + page);
+    coherence = peakAbs(:)./sqrt(max(passEnergy.*refEnergy,realmin));
+
+    % parabola through the peak and its (cyclic) neighbours in x and y
+    around = @(ix,iy)abs(xc(mod(ix-1,T)+1 + mod(iy-1,T)*T + page));
+    tileShift = [lag(px) + vertex(around(px-1,py),peakAbs(:),around(px+1,py)),...
+        lag(py) + vertex(around(px,py-1),peakAbs(:),around(px,py+1))];
+    clear xc;
+
+    % shift of the pass from the coherent tiles near the median
+    good = coherence >= opts.minCoherence;
+    if ~any(good)
+        warning('coregisterPasses:coherence','No coherent tile in pass %d.',p);
+        continue;
+    end
+    good = good & all(abs(tileShift - median(tileShift(good,:),1)) <= 1,2);
+    w = coherence(good);
+    shift(p,:) = sum(w.*tileShift(good,:),1)/sum(w);
+
+    % residual phase screen from the phasors of the coherent tiles
+    z = zeros(numTiles);
+    z(good) = w.*exp(1i*angle(peakValue(good)));
+    if strcmp(opts.phaseModel,'plane') && all(numTiles > 1)
+        pad = 8*numTiles;
+        [~,k] = max(reshape(abs(fft2(z,pad(1),pad(2))),[],1));
+        [kx,ky] = ind2sub(pad,k);
+        % phase per tile step, wrapped to (-pi,pi]
+        step = angle(exp(1i*2*pi*([kx ky]-1)./pad));
+        gradient(p,:) = step/T;
+    end
+    if ~strcmp(opts.phaseModel,'none')
+        phase(p) = angle(sum(z(:).*exp(-1i*(cx(:)*gradient(p,1) + cy(:)*gradient(p,2)))));
+    end
+    info.tileShift{p} = tileShift;
+    info.tilePhase{p} = angle(peakValue);
+    info.coherence{p} = coherence;
+    fprintf('Coregistration of pass %d: shift [%.3f %.3f] pixels, phase %.3f rad, %d of %d tiles\n',...
+        p,shift(p,:),phase(p),nnz(good),length(good));
+end
+
+end
+
+%% Tapered tiles of an image as the pages of a T x T x numTiles array
+function t = tiles(im,T,numTiles,taper)
+t = reshape(im(1:numTiles(1)*T,1:numTiles(2)*T),T,numTiles(1),T,numTiles(2));
+t = reshape(permute(t,[1 3 2 4]),T,T,[]).*taper;
+end
+
+%% Offset of the vertex of the parabola through (-1,a), (0,b), (1,c)
+function d = vertex(a,b,c)
+denominator = a - 2*b + c;
+d = 0.5*(a - c)./denominator;
+d(denominator >= 0) = 0;
+d = max(min(d,0.5),-0.5);
+end
@@ -0,0 +1,60 @@
+%test script coregistration_experiment.m for the sign conventions of
+%coregisterPasses.m, applyCoregistration.m and of the corrections that
+%JointSparseRecovery_3D.m applies while sampling the phase history of a
+%pass (knots offset by the phase gradient, phase ramp of the shift)
+%
+%NOTE: needs the MEX file FGG_Convolution2D_type2 of the NUFFT folder
+
+clear all;
+close all;
+addpath NUFFT;
+
+rng(1);
+n=512;
+Res=[0.5 0.5];
+%Speckle limited to half the band, as an oversampled SAR image, and
+%tapered to zero near the edges so the cyclic shifts below are linear ones
+[fx,fy]=ndgrid(ifftshift(-n/2:n/2-1)/n);
+reference=ifft2((abs(fx)<1/4 & abs(fy)<1/4).*fft2(randn(n)+1i*randn(n)));
+edge=0.5-0.5*cos(pi*min(max(((1:n).'-32)/32,0),1));
+edge=min(edge,flipud(edge));
+reference=reference.*(edge*edge.');
+
+%The pass in the convention of coregisterPasses.m:
+%    pass(r + shift) = reference(r).*exp(1i*(phase + gradient*[x; y]))
+%with a gradient on the frequency grid of the 'plane' fit (tiles of 64
+%pixels, 8 x 8 tiles padded to 64)
+trueShift=[2.3 -1.6];
+truePhase=0.7;
+trueGradient=2*pi*[3 -2]/(64*64);
+x=(1:n).'-(floor(n/2)+1);
+y=(1:n)-(floor(n/2)+1);
+pass=ifft2(fft2(reference.*exp(1i*(truePhase+trueGradient(1)*x+trueGradient(2)*y))).*...
+    exp(-1i*2*pi*(fx*trueShift(1)+fy*trueShift(2))));
+
+%Estimates of coregisterPasses.m
+[shift,phase,gradient]=coregisterPasses({reference,pass},1,...
+    struct('tileSize',64,'phaseModel','plane'));
+Shift_error=norm(shift(2,:)-trueShift)
+Phase_error=abs(angle(exp(1i*(phase(2)-truePhase))))
+Gradient_error=norm(gradient(2,:)-trueGradient)
+
+%applyCoregistration.m must undo the pass exactly with the true values,
+%and up to the estimation errors with the estimated ones
+Correction_error=norm(applyCoregistration(pass,trueShift,truePhase,trueGradient)-reference,'fro')/...
+    norm(reference,'fro')
+Estimated_correction_error=norm(applyCoregistration(pass,shift(2,:),phase(2),gradient(2,:))-...
+    reference,'fro')/norm(reference,'fro')
+
+%Phase history as in JointSparseRecovery_3D.m: the pass sampled at the
+%knots offset by the gradient, times the ramp of the shift and the phase,
+%must be the reference sampled at the knots
+kx_grid=linspace(-1/2/Res(1),1/2/Res(1),n+1); kx_grid(end)=[];
+ky_grid=linspace(-1/2/Res(2),1/2/Res(2),n+1); ky_grid(end)=[];
+knots=(rand(2000,2)-1/2)./(2*Res);
+d=trueShift.*Res;
+g=trueGradient./(2*pi*Res);
+yReference=iFGG_2d_type2mod(reference,knots,12,kx_grid,ky_grid);
+yPass=iFGG_2d_type2mod(pass,[knots(:,1)-g(1) knots(:,2)-g(2)],12,kx_grid,ky_grid);
+yPass=exp(-1i*2*pi*(knots(:,1)*d(1)+knots(:,2)*d(2))-1i*(truePhase-2*pi*g*d.')).*yPass;
+Phase_history_error=norm(yPass-yReference)/norm(yReference)
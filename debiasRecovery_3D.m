@@ -0,0 +1,128 @@
+%% Least-squares debiasing of the sparse 3D reflectivity on the detected points
+% The group-L1 solution of JointSparseRecovery_3D.m is shrunk towards zero,
+% which lowers the amplitudes of the weaker scatterers more than those of
+% the stronger ones and biases the dB thresholds applied later
+% (image3d_integrate.m). This refits the amplitudes of the support voxels
+% (the detected points) by least squares,
+%     min ||A_S x_S - b||_2,
+% with LSQR started at the sparse solution. A_S is the operator restricted
+% to the support. The support is split into tiles in x and y, and each
+% tile is a type-3 NUFFT between the knots and its voxels
+% (FGG_3d_type3plan.m), whose inner grid only covers the bounding box of
+% the tile; A_S is the sum over the tiles. The number of tiles (1, 4,
+% 16, ...) is the one with the lowest estimated cost of one product,
+%     tiles*M*(2*M_sp)^3 + sum over the tiles of Ng*log2(Ng),
+% with Ng the size of the inner grid, and the grid operator with the other
+% voxels held at zero is used when its own cost is lower. Every tile keeps
+% a plan on all the knots, so at most maxTiles are used.
+%
+% inputs
+% x - solution of the sparse recovery, voxels in the order of layout
+% b - measurements
+% plan - NUFFT plan of the grid operator (FGG_3d_plan.m)
+% knots - Mx3 k-space locations of the measurements (same order as b)
+% Res - [Res_x Res_y Res_z] voxel spacing (m)
+% support - indices of the voxels to refit (in the order of layout)
+% maxIter - maximum number of LSQR iterations
+% layout - (optional) voxel layout of x (voxelLayout.m), default z fastest,
+%          then x, then y
+% outputs
+% values - debiased amplitudes of the support voxels
+% info - struct with the operator used ('type3' or 'grid'), the number of
+%        tiles and the LSQR flag, relative residual and iterations
+
+function [values,info] = debiasRecovery_3D(x,b,plan,knots,Res,support,maxIter,layout)
+
+maxTiles = 16;
+N = plan.N;
+if nargin < 8
+    layout = voxelLayout(N,'zxy');
+end
+support = support(:);
+if isempty(support)
+    values = zeros(0,1);
+    info = struct('operator','none','tiles',0,'flag',0,'relres',0,'iter',0);
+    return;
+end
+[ix,iy,iz] = voxelLayoutSubscripts(layout,support);
+targets = ([ix iy iz]-1-N/2).*Res;
+clear iz;
+
+% estimated cost of one product: gridding of every knot plus the FFT
+M_sp = max(plan.M_sp);
+numKnots = size(knots,1);
+halfBand = max((max(knots,[],1)-min(knots,[],1))/2,eps);
+fftCost = @(P)P.*log2(max(P,2));
+bestCost = numKnots*prod(2*plan.M_sp) + fftCost(prod(plan.M_r));
+info.operator = 'grid';
+info.tiles = 0;
+for tilesPerAxis = 2.^(0:floor(log2(sqrt(maxTiles))))
+    tile = floor((ix-1)*tilesPerAxis/N(1)) + tilesPerAxis*floor((iy-1)*tilesPerAxis/N(2)) + 1;
+    [~,~,tile] = unique(tile);
+    numTiles = max(tile);
+    % inner grid of each tile as in FGG_3d_type3plan.m
+    cost = numTiles*numKnots*(2*M_sp)^3;
+    for t = 1:numTiles
+        halfWidth = (max(targets(tile==t,:),[],1)-min(targets(tile==t,:),[],1))/2;
+        cost = cost + fftCost(prod(2*ceil((8*halfWidth.*halfBand+2*M_sp+2)/2)));
+    end
+    if cost < bestCost
+        bestCost = cost;
+        info.operator = 'type3';
+        info.tiles = numTiles;
+        bestTile = tile;
+    end
+end
+clear ix iy;
+
+if strcmp(info.operator,'type3')
+    members = cell(info.tiles,1);
+    type3Plans = cell(info.tiles,1);
+    for t = 1:info.tiles
+        members{t} = find(bestTile==t);
+        type3Plans{t} = FGG_3d_type3plan(knots,targets(members{t},:),M_sp);
+    end
+    clear bestTile;
+    afun = @(v,transpose)type3Operator(v,transpose,type3Plans,members);
+else
+    afun = @(v,transpose)gridOperator(v,transpose,plan,layout,support);
+end
+clear targets;
+
+[values,info.flag,info.relres,info.iter] = lsqr(afun,b,1e-6,maxIter,[],[],x(support));
+if strcmp(info.operator,'type3')
+    for t = 1:info.tiles
+        FGG_3d_planDestroy(type3Plans{t});
+    end
+end
+fprintf('Debiasing: %d voxels, %s operator (%d tiles), %d LSQR iterations, relative residual %.3g\n',...
+    length(support),info.operator,info.tiles,info.iter,info.relres);
+
+end
+
+%% Operator of the support voxels for LSQR via the type-3 NUFFT of every tile
+function y = type3Operator(v,transpose,type3Plans,members)
+if strcmp(transpose,'notransp')
+    y = iFGG_3d_type3(v(members{1}),type3Plans{1});
+    for t = 2:length(members)
+        y = y + iFGG_3d_type3(v(members{t}),type3Plans{t});
+    end
+else
+    y = zeros(sum(cellfun(@numel,members)),1);
+    for t = 1:length(members)
+        y(members{t}) = FGG_3d_type3(v,type3Plans{t});
+    end
+end
+end
+
+%% Operator of the support voxels for LSQR via the grid operator
+function y = gridOperator(v,transpose,plan,layout,support)
+if strcmp(transpose,'notransp')
+    xFull = zeros(prod(plan.N),1);
+    xFull(support) = v;
+    y = sar_operator_nufft_3d_plan(xFull,1,plan,layout);
+else
+    y = sar_operator_nufft_3d_plan(v,2,plan,layout);
+    y = y(support);
+end
+end
@@ -0,0 +1,117 @@
+%% Detects the scatterers of a recovered 3D reflectivity
+% Replaces the global threshold (every voxel within floorDb dB of the
+% maximum) by a detector that adapts to the neighbourhood of every voxel.
+% A voxel is kept when
+%   - its power is a local maximum of its z-column within peakRadius
+%     voxels, so a scatterer and its sidelobes in height give one point,
+%   - it exceeds alpha times the mean power of the training cells around
+%     it (cell-averaging CFAR): the box of train+guard voxels around it
+%     minus the box of guard voxels, with alpha set for the false-alarm
+%     rate pfa of exponentially distributed noise,
+%   - and it is within floorDb dB of the maximum, which bounds the
+%     detections where the training cells are empty.
+% The sparse solution of JointSparseRecovery_3D.m is exactly zero in most
+% voxels, so the training cells of many voxels hold no power and only the
+% floor test applies to them; their number is printed. The detector is
+% meant for volumes with a populated background, and
+% JointSparseRecovery_3D.m uses the plain threshold by default.
+% The box sums are separable sliding sums (movsum along z, x and y), so the
+% cost is linear in the volume and independent of the box size. The volume
+% is processed in slabs of y-planes, each read through the voxel layout
+% with enough planes around it for the boxes, so no copy of the whole
+% volume is made.
+% inputs
+% x - recovered volume as a vector, in the order of layout
+% layout - voxel layout of x (voxelLayout.m)
+% opts - (optional) struct with the fields
+%       floorDb - dynamic range of the detections (default 80)
+%       pfa - false-alarm rate of the CFAR test (default 1e-4)
+%       guard - [x y z] half sizes of the guard box (default [1 1 2])
+%       train - [x y z] training voxels beyond the guard box (default
+%               [4 4 8])
+%       peakRadius - z-voxels on each side a column peak must exceed
+%               (default 2, 0 for no peak picking)
+%       slabPlanes - y-planes per slab (default 32)
+% outputs
+% kept - indices of the detected voxels in x, ascending
+% cfarDb - their power over the mean of their training cells (dB)
+
+function [kept,cfarDb] = detectPoints3D(x,layout,opts)
+
+if nargin < 3
+    opts = struct();
+end
+defaults = struct('floorDb',80,'pfa',1e-4,'guard',[1 1 2],'train',[4 4 8],...
+    'peakRadius',2,'slabPlanes',32);
+names = fieldnames(defaults);
+for i=1:length(names)
+    if ~isfield(opts,names{i})
+        opts.(names{i}) = defaults.(names{i});
+    end
+end
+N = layout.N;
+% the slabs are z x x x y, so the box sizes are reordered to [z x y]
+guard = opts.guard([3 1 2]);
+outer = guard + opts.train([3 1 2]);
+floorPower = max(abs(x))^2*10^(-opts.floorDb/10);
+
+% number of training cells of an interior voxel and the CFAR factor
+numTrain = prod(2*outer+1) - prod(2*guard+1);
+alpha = numTrain*(opts.pfa^(-1/numTrain)-1);
+% numbers of training cells near the faces, separable like the sums
+boxCount = @(n,h)movsum(ones(n,1),2*h+1);
+countZ = {boxCount(N(3),outer(1)),boxCount(N(3),guard(1))};
+countX = {boxCount(N(1),outer(2)).',boxCount(N(1),guard(2)).'};
+countY = {boxCount(N(2),outer(3)),boxCount(N(2),guard(3))};
+
+planeBase = layout.offset{3} + layout.offset{1}.' + 1;
+halo = outer(3);
+kept = cell(1,ceil(N(2)/opts.slabPlanes));
+cfarDb = cell(size(kept));
+numEmpty = 0;
+for s = 1:length(kept)
+    planes = (s-1)*opts.slabPlanes+1:min(s*opts.slabPlanes,N(2));
+    readPlanes = max(planes(1)-halo,1):min(planes(end)+halo,N(2));
+    P = zeros(N(3),N(1),length(readPlanes));
+    for k = 1:length(readPlanes)
+        P(:,:,k) = abs(x(planeBase+layout.offset{2}(readPlanes(k)))).^2;
+    end
+    central = planes - readPlanes(1) + 1;
+
+    % training cells: the outer box minus the guard box
+    trainSum = boxSum(P,outer,central) - boxSum(P,guard,central);
+    Pc = P(:,:,central);
+    clear P;
+    trainCount = countZ{1}.*countX{1}.*reshape(countY{1}(planes),1,1,[]) - ...
+        countZ{2}.*countX{2}.*reshape(countY{2}(planes),1,1,[]);
+    noise = max(trainSum,0)./trainCount;
+    clear trainSum trainCount;
+
+    detected = Pc > alpha*noise & Pc > floorPower;
+    if opts.peakRadius > 0
+        detected = detected & Pc >= movmax(Pc,2*opts.peakRadius+1,1);
+    end
+    found = find(detected);
+    [inPlane,plane] = ind2sub([N(3)*N(1) length(planes)],found);
+    kept{s} = planeBase(inPlane) + layout.offset{2}(planes(plane));
+    cfarDb{s} = 10*log10(Pc(found)./max(noise(found),realmin));
+    numEmpty = numEmpty + nnz(noise(found) == 0);
+    clear Pc noise detected found inPlane plane;
+end
+kept = vertcat(kept{:});
+cfarDb = vertcat(cfarDb{:});
+[kept,order] = sort(kept);
+cfarDb = cfarDb(order);
+fprintf('CFAR: %d points, %d of them with empty training cells (floor test only)\n',...
+    length(kept),numEmpty);
+
+end
+
+%% Sum over the box of half sizes h around every voxel of the central
+% planes, as three sliding sums
+function S = boxSum(P,h,central)
+S = movsum(P,2*h(3)+1,3);
+S = S(:,:,central);
+S = movsum(S,2*h(1)+1,1);
+S = movsum(S,2*h(2)+1,2);
+end
@@ -0,0 +1,95 @@
+%% Sliding-aperture backprojection: updates a running image as the
+% azimuth window advances instead of forming every image from scratch.
+% The pulses that enter the window are backprojected and added, the pulses
+% that leave it are backprojected and subtracted (bpPulse.m), so the cost
+% per image is proportional to twice the azimuth step rather than the
+% window: it only pays when the step is below half the window (at 50%
+% overlap it backprojects as many pulses as forming the image anew). The
+% window membership is diffed against the previous call, so images can be
+% skipped (e.g. when they are cached) and the windows may wrap around 360
+% degrees. The Hamming taper of formImageSimulationNew is not supported
+% since its weights depend on the position of a pulse within the window.
+% Like formImageSimulationNew, the image uses the start frequency and
+% frequency step of the first pulse of the window; when they differ from
+% those of the running image, the image is re-formed from scratch.
+%
+% inputs
+% state - [] on the first call, afterwards the state returned by the
+%         previous call
+% idxFinal - indices of the pulses in the current window
+% phdata - phase history of the whole pass (frequencies x pulses)
+% freq - frequencies of every pulse of the pass (frequencies x pulses)
+% AntX,AntY,AntZ - position of the radar at every pulse of the pass
+% R0 - range to scene center at every pulse of the pass
+% Nfft - number of samples in the FFT forming the range profiles
+% xImage - image coordinates in x direction
+% yImage - image coordinates in y direction
+% refreshEvery - (optional) re-form the image from scratch every
+%               refreshEvery calls to flush accumulated rounding errors
+%               (default 16, 0 for never)
+% outputs
+% im_final - image formed from the pulses idxFinal
+% state - running image and window membership for the next call
+
+function [im_final,state] = formImageSlidingAperture(state,idxFinal,phdata,freq,...
+    AntX,AntY,AntZ,R0,Nfft,xImage,yImage,refreshEvery)
+
+if nargin < 12
+    refreshEvery = 16;
+end
+
+cspeed = 299792458;
+numPulses = size(phdata,2);
+
+if isempty(state)
+    [state.x_mat,state.y_mat] = meshgrid(xImage,yImage);
+    state.z_mat = zeros(size(state.x_mat));
+    state.im_final = zeros(size(state.x_mat));
+    state.inWindow = false(1,numPulses);
+    state.numUpdates = 0;
+    state.minF = NaN;
+    state.deltaF = NaN;
+end
+
+inWindow = false(1,numPulses);
+inWindow(idxFinal) = true;
+
+% same range-profile grid as formImageSimulationNew/bpBasic_mod, from the
+% first pulse of the window
+minF = min(freq(:,idxFinal(1)));
+deltaF = diff(freq(1:2,idxFinal(1)));
+newGrid = minF ~= state.minF || deltaF ~= state.deltaF;
+if newGrid
+    state.minF = minF;
+    state.deltaF = deltaF;
+    maxWr = cspeed/(2*deltaF);
+    state.r_vec = linspace(-Nfft/2,Nfft/2-1,Nfft)*maxWr/Nfft;
+end
+
+state.numUpdates = state.numUpdates + 1;
+if newGrid || (refreshEvery > 0 && mod(state.numUpdates,refreshEvery) == 0)
+    state.im_final(:) = 0;
+    state.inWindow(:) = false;
+end
+
+entering = find(inWindow & ~state.inWindow);
+leaving = find(state.inWindow & ~inWindow);
+
+for ii = entering
+    [pulseImage,I] = bpPulse(phdata(:,ii),AntX(ii),AntY(ii),AntZ(ii),R0(ii),...
+        state.minF,state.r_vec,Nfft,state.x_mat,state.y_mat,state.z_mat);
+    state.im_final(I) = state.im_final(I) + pulseImage;
+end
+for ii = leaving
+    [pulseImage,I] = bpPulse(phdata(:,ii),AntX(ii),AntY(ii),AntZ(ii),R0(ii),...
+        state.minF,state.r_vec,Nfft,state.x_mat,state.y_mat,state.z_mat);
+    state.im_final(I) = state.im_final(I) - pulseImage;
+end
+
+fprintf('Sliding aperture: %d pulses added, %d removed, %d in window\n',...
+    length(entering),length(leaving),length(idxFinal));
+
+state.inWindow = inWindow;
+im_final = state.im_final;
+
+end
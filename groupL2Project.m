@@ -0,0 +1,26 @@
+%% Projection onto the ball of the weighted group L2,1 norm
+%     sum_g weight*||x_g||_2 <= tau
+% The group norms are projected onto the L1 ball of radius tau/weight and
+% every group is shrunk by the same factor as its norm.
+% inputs
+% G - sparse indicator matrix, G(g,i) = 1 if unknown i is in group g
+% x - vector to project
+% weight - weight of the norm (scalar)
+% tau - radius of the ball
+% outputs
+% x - projection of x
+
+function x = groupL2Project(G,x,weight,tau)
+
+normGroup = sqrt(G*abs(x).^2);
+radius = tau/weight;
+if sum(normGroup) <= radius
+    return;
+end
+sorted = sort(normGroup,'descend');
+threshold = (cumsum(sorted)-radius)./(1:length(sorted)).';
+k = find(sorted > threshold,1,'last');
+shrink = max(normGroup-threshold(k),0)./max(normGroup,realmin);
+x = x.*(G.'*shrink);
+
+end
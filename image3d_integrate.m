@@ -5,15 +5,30 @@ close all;
 
 d = dir('/p/work1/cnieter/sar_images/3d_results/Results_3D_*.mat');
 snrThreshold = 50; % dB below max value that is diplayed
+% dB below the max of each aperture at which its points are extracted
+% again from Volume_3D_###.mat (readSparseVolume.m) instead of taking the
+% points of Results_3D_###.mat (empty)
+volumeThreshold = [];
+% amplitudes of those points: 'debiased' (the detected points, as in
+% Results_3D_###.mat) or 'solver' (every voxel of the solver output)
+volumeValues = 'debiased';
 
 numImages = length(d);
 load(sprintf('/p/work1/cnieter/sar_images/3d_results/%s', d(1).name));
+if ~isempty(volumeThreshold)
+    [sc_points_layOver,amps] = readSparseVolume(sprintf('/p/work1/cnieter/sar_images/3d_results/%s',...
+        strrep(d(1).name,'Results_3D_','Volume_3D_')),volumeThreshold,volumeValues);
+end
 
 pointsTotal = sc_points_layOver.';
 ampsTotal = amps;
 
 for idxImages = 2:numImages
     load(sprintf('/p/work1/cnieter/sar_images/3d_results/%s', d(idxImages).name));
+    if ~isempty(volumeThreshold)
+        [sc_points_layOver,amps] = readSparseVolume(sprintf('/p/work1/cnieter/sar_images/3d_results/%s',...
+            strrep(d(idxImages).name,'Results_3D_','Volume_3D_')),volumeThreshold,volumeValues);
+    end
     % Find the intersection of the points from all previous viewws with the
     % new view
     [pointsTemp,idxTotal,idxNew] = intersect(pointsTotal,sc_points_layOver.','rows'); 
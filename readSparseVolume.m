@@ -0,0 +1,64 @@
+%% Extracts the points above a threshold from a sparse volume
+% Reads a file of writeSparseVolume.m and returns the voxels within
+% thresholdDb dB of the maximum of the volume, as the point cloud of
+% JointSparseRecovery_3D.m. Only the stored voxels are visited, so
+% changing the threshold costs a file read instead of a sparse solve.
+% Thresholds below the floor of the file return all stored voxels.
+% The voxels are selected on the solver output. With the 'debiased' value
+% set, only the detected points among them are returned, with their
+% debiased values: at the threshold of JointSparseRecovery_3D.m
+% (snrThreshold) these are the points and amplitudes of Results_3D_###.mat
+% (up to single precision),
+% and thresholds below it return the detected points only.
+% inputs
+% fileName - file written by writeSparseVolume.m
+% thresholdDb - voxels within thresholdDb dB of the maximum are returned
+% valueSet - (optional) 'debiased' (default when the file has the detected
+%            points) or 'solver'
+% outputs
+% points - 3 x n coordinates [axis1; axis2; zAxis] of the voxels (m)
+% amps - 20*log10 of their magnitudes (n x 1)
+% values - their complex values (n x 1)
+
+function [points,amps,values] = readSparseVolume(fileName,thresholdDb,valueSet)
+
+v = load(fileName);
+if nargin < 3
+    if isfield(v,'detected')
+        valueSet = 'debiased';
+    else
+        valueSet = 'solver';
+    end
+end
+keep = abs(v.values) > v.maxAbs*10^(-thresholdDb/20);
+if strcmp(valueSet,'debiased')
+    if ~isfield(v,'detected')
+        error('readSparseVolume:noDetectedPoints','%s holds no detected points.',fileName);
+    end
+    debiased = complex(zeros(size(v.values),'single'));
+    debiased(v.detected) = v.debiasedValues;
+    keep = keep & v.detected;
+    values = double(debiased(keep));
+    clear debiased;
+else
+    values = double(v.values(keep));
+end
+
+% run and offset within the run of every stored voxel
+numRuns = length(v.runStart);
+run = repelem((1:numRuns).',double(v.runLength));
+runFirst = cumsum([1; double(v.runLength)]);
+offset = (1:length(run)).' - runFirst(run);
+run = run(keep);
+z = double(v.runStart(run)) + offset(keep);
+% column of every run
+runColumn = repelem((0:v.M(2)*v.M(3)-1).',double(diff(v.columnRuns)));
+column = runColumn(run);
+i1 = mod(column,v.M(2));
+i2 = (column-i1)/v.M(2);
+
+axis1 = v.axis1(:).'; axis2 = v.axis2(:).'; zAxis = v.zAxis(:).';
+points = [axis1(i1+1); axis2(i2+1); zAxis(z+1)];
+amps = 20*log10(abs(values));
+
+end
@@ -0,0 +1,85 @@
+%test script recovery_3D_experiment.m for the solver stages of
+%JointSparseRecovery_3D.m on small synthetic scenes, where the reference
+%solutions are cheap enough to compute.
+%
+%NOTE: needs SPGL1 (spg_group, spgl1, spgSetParms) on the path and the
+%MEX files of the NUFFT folder compiled (see NUFFT/fgg_3D_plan_experiment.m)
+
+clear all;
+close all;
+addpath NUFFT;
+
+rng(1);
+N=[16,16,8];
+M=4000;
+accuracy=6;
+GridListx=linspace(-1/2,1/2,N(1)+1);
+GridListy=linspace(-1/2,1/2,N(2)+1);
+GridListz=linspace(-1/2,1/2,N(3)+1);
+%The data band is narrower than the voxel grid, as in JointSparseRecovery_3D.m,
+%so that the downsampled grids of the coarse-to-fine mode still hold it
+knots=(rand(M,3)-1/2)/4;
+plan=FGG_3d_plan(knots,N,accuracy,GridListx,GridListy,GridListz);
+A=@(x,mode)sar_operator_nufft_3d_plan(x,mode,plan);
+layout=voxelLayout(N,'zxy');
+groups=reshape(repmat(1:N(1)*N(2),N(3),1),[],1);
+%a few scatterers, two of them in the same z-column
+numScatterers=6;
+xTrue=zeros(prod(N),1);
+column=randperm(N(1)*N(2),numScatterers-1);
+column=[column column(1)];
+height=randi(N(3),1,numScatterers-1);
+height=[height mod(height(1)+N(3)/2-1,N(3))+1];
+xTrue((column-1)*N(3)+height)=(1+rand(1,numScatterers)).*exp(2i*pi*rand(1,numScatterers));
+noise=1e-3*(randn(M,1)+1i*randn(M,1));
+b=A(xTrue,1)+noise;
+sigma=norm(noise);
+options=spgSetParms('isComplex',1,'verbosity',0,'optTol',1e-4);
+
+%Coarse-to-fine (coarseToFineRecovery_3D.m) against the direct solve: the
+%support of the coarse solution must contain every voxel of the direct
+%solution, and the two solutions must agree to the solver tolerance
+[xDirect,~,~,infoDirect]=spg_group(A,b,groups,sigma,options);
+for factor=[2 4]
+    [xCoarseToFine,info]=coarseToFineRecovery_3D(A,b,groups,sigma,options,knots,N,...
+        accuracy,'auto',{GridListx,GridListy,GridListz},factor,40,1);
+    directSupport=find(abs(xDirect)>max(abs(xDirect))*1e-2);
+    disp(['Coarse-to-fine, factor ',num2str(factor),': ',...
+        num2str(nnz(~ismember(directSupport,info.support))),' of ',...
+        num2str(length(directSupport)),' voxels of the direct solution outside the support, ',...
+        'relative difference ',num2str(norm(xCoarseToFine-xDirect)/norm(xDirect)),', ',...
+        num2str(info.coarse.nProdA+info.fine.nProdA),' products with A (direct ',...
+        num2str(infoDirect.nProdA),')'])
+end
+
+%SVRG blocks (svrgGroupRecovery.m): a plan of a block of knots divides by
+%its own number of knots, so the block operators are rescaled to the rows
+%of A, as in JointSparseRecovery_3D.m, and their normal operators must sum
+%to the one of A
+numBlocks=4;
+blockEdges=round(linspace(0,M,numBlocks+1));
+blockPlans=cell(1,numBlocks);
+AtAx=zeros(prod(N),1);
+x=randn(prod(N),1)+1i*randn(prod(N),1);
+for p=1:numBlocks
+    blockRows=blockEdges(p)+1:blockEdges(p+1);
+    blockPlans{p}=FGG_3d_plan(knots(blockRows,:),N,accuracy,GridListx,GridListy,GridListz);
+    blockScale=numel(blockRows)/M;
+    AtAx=AtAx+blockScale^2*sar_operator_nufft_3d_plan(...
+        sar_operator_nufft_3d_plan(x,1,blockPlans{p}),2,blockPlans{p});
+end
+Block_sum_error=norm(AtAx-A(A(x,1),2))/norm(A(A(x,1),2))
+cellfun(@FGG_3d_planDestroy,blockPlans);
+
+%Density compensation (FGG_3d_densityComp.m): the weighted problem, with
+%sigma rescaled to the weighted noise, against the direct solve
+sqrtW=sqrt(FGG_3d_densityComp(plan,10));
+Aw=@(x,mode)sar_operator_weighted(x,mode,A,sqrtW);
+[xWeighted,~,~,infoWeighted]=spg_group(Aw,sqrtW.*b,groups,norm(sqrtW.*noise),options);
+disp(['Density compensation: ',num2str(infoWeighted.iter),' iterations and ',...
+    num2str(infoWeighted.nProdA),' products with A (without: ',num2str(infoDirect.iter),...
+    ' and ',num2str(infoDirect.nProdA),'), relative error ',...
+    num2str(norm(xWeighted-xTrue)/norm(xTrue)),' (without: ',...
+    num2str(norm(xDirect-xTrue)/norm(xTrue)),')'])
+
+FGG_3d_planDestroy(plan);
@@ -0,0 +1,28 @@
+%% 3D SAR measurement operator for SPGL1 using a persistent NUFFT plan
+% inputs
+% x - voxel vector (mode 1) in the order of layout, or the measurement
+%     vector (mode 2); several vectors as the columns of x are transformed
+%     together (one column of y each)
+% mode - 1 for the forward operator A*x (type-2 NUFFT from the voxels to
+%        the k-space knots), 2 for the adjoint A'*x
+% plan - plan from FGG_3d_plan.m created with the knots [k_x k_y k_z] and
+%        the voxel grid [M_x M_y M_z]
+% layout - (optional) order of the voxels (voxelLayout.m), default z
+%          fastest, then x, then y. The NUFFT reads and writes the voxels
+%          in this order directly, so the volume is never permuted.
+% The adjoint is the exact conjugate transpose of the forward operator: the
+% type-1 gridding equals A' up to the factor 1/(M_x*M_y*M_z).
+
+function y = sar_operator_nufft_3d_plan(x,mode,plan,layout)
+
+N = plan.N;
+if nargin < 4
+    layout = voxelLayout(N,'zxy');
+end
+if mode == 1
+    y = iFGG_3d_type2plan(x,plan,layout);
+else
+    y = FGG_3d_type1plan(x,plan,layout)/prod(N);
+end
+
+end
@@ -0,0 +1,26 @@
+%% Density-weighted SAR measurement operator for SPGL1
+% Applies the diagonal preconditioner diag(sqrt(w)) on the measurement side
+% of an operator,
+%     A_w = diag(sqrt(w))*A,
+% so that SPGL1 solves min ||x|| s.t. ||sqrt(w).*(A*x - b)|| <= sigma with
+% the data b_w = sqrt(w).*b. With the density-compensation weights of the
+% knots (FGG_3d_densityComp.m) the densely sampled parts of k-space no
+% longer dominate the residual, A_w'*A_w is much closer to a multiple of
+% the identity than A'*A, and the solver needs fewer operator applications.
+% With mean(w) = 1 the norm of white noise is unchanged on average, so the
+% same sigma applies.
+% inputs
+% x - voxel vector (mode 1) or measurement vector (mode 2)
+% mode - 1 for A_w*x, 2 for the adjoint A_w'*x
+% A - operator @(x,mode), e.g. sar_operator_nufft_3d_plan.m
+% sqrtW - square roots of the weights of the measurements
+
+function y = sar_operator_weighted(x,mode,A,sqrtW)
+
+if mode == 1
+    y = sqrtW.*A(x,1);
+else
+    y = A(sqrtW.*x,2);
+end
+
+end
@@ -0,0 +1,20 @@
+%% SPGL1 options for the group L2,1 norm of spg_group on a given grouping
+% spg_group always starts from zero. Calling spgl1 directly with these
+% options solves the same problem from a starting point x0:
+%     spgl1(A,b,options.primal_norm(x0,1),sigma,x0,options)
+% starts the root finding at the norm of x0 instead of at zero.
+% inputs
+% options - SPGL1 options (spgSetParms)
+% groups - group of every unknown
+% outputs
+% options - options with the projection, primal norm and dual norm set
+
+function options = spgGroupOptions(options,groups)
+
+[~,~,groupIndex] = unique(groups(:));
+G = sparse(groupIndex,1:length(groupIndex),1);
+options.project = @(x,weight,tau)groupL2Project(G,x,weight,tau);
+options.primal_norm = @(x,weight)weight*sum(sqrt(G*abs(x).^2));
+options.dual_norm = @(x,weight)max(sqrt(G*abs(x).^2))/weight;
+
+end
@@ -0,0 +1,198 @@
+%% Group-sparse recovery with several Pareto-curve points per root-finding step
+% Solves the problem of spg_group (SPGL1),
+%     min sum_g ||x_g||_2  s.t.  ||A*x - b||_2 <= sigma,
+% by root finding on the Pareto curve
+%     phi(tau) = min ||A*x - b||_2  s.t.  sum_g ||x_g||_2 <= tau,
+% like SPGL1, but every root-finding step solves the subproblems of
+% paretoPoints values of tau at once instead of one. Their iterates are the
+% columns of one matrix, so the operator is applied to all of them in one
+% call: the NUFFT plan (sar_operator_nufft_3d_plan.m) grids the columns
+% concurrently on separate groups of threads and the FFTs run on the whole
+% batch, which keeps cores busy that a single subproblem cannot use. Since
+% phi is convex and decreasing, the Newton step from the last point left of
+% the root and the secant through the last points on both sides of it
+% bracket the root; the next values of tau are spread over that bracket
+% (or beyond the Newton step while no point right of the root is known),
+% so every step shrinks the bracket much more than one Newton step. Each
+% point keeps its own iterate, residual and gradient, so the memory grows
+% with paretoPoints.
+%
+% inputs
+% A - operator @(x,mode) applied to the columns of x (mode 1: A*x,
+%     mode 2: A'*x)
+% b - measurements
+% groups - group of every unknown
+% sigma - bound on the norm of the residual
+% opts - (optional) struct with the fields
+%       paretoPoints - values of tau per step (default 3; 1 is SPGL1's
+%               Newton iteration)
+%       optTol - tolerance on the relative duality gap of the subproblems
+%               and on the relative error of the residual norm (default
+%               1e-4)
+%       maxOuter - maximum number of root-finding steps (default 30)
+%       maxInner - maximum number of projected-gradient iterations per
+%               step (default 200)
+%       verbosity - 0 silent, 1 one line per step (default 1)
+% x0 - (optional) starting point
+% outputs
+% x - solution
+% r - residual b - A*x
+% info - struct with tau, the residual norm rNorm, the number of steps
+%        numOuter and the number of operator applications numProducts (one
+%        per column)
+
+function [x,r,info] = spgGroupPareto(A,b,groups,sigma,opts,x0)
+
+if nargin < 5
+    opts = struct();
+end
+defaults = struct('paretoPoints',3,'optTol',1e-4,'maxOuter',30,'maxInner',200,...
+    'verbosity',1);
+names = fieldnames(defaults);
+for i=1:length(names)
+    if ~isfield(opts,names{i})
+        opts.(names{i}) = defaults.(names{i});
+    end
+end
+K = opts.paretoPoints;
+b = b(:);
+bNorm = norm(b);
+info.numProducts = 0;
+
+[~,~,groupIndex] = unique(groups(:));
+G = sparse(groupIndex,1:length(groupIndex),1);
+n = size(G,2);
+groupNorm = @(X)full(sqrt(G*abs(X).^2));
+
+if nargin < 6 || isempty(x0)
+    x0 = zeros(n,1);
+end
+% left end of the bracket: the starting point on its own Pareto point
+lo.tau = sum(groupNorm(x0));
+lo.x = x0;
+lo.r = b - apply(x0,1);
+lo.phi = norm(lo.r);
+lo.slope = max(groupNorm(apply(lo.r,2)))/max(lo.phi,realmin);
+hi.tau = inf;
+hi.phi = 0;
+x = lo.x;
+r = lo.r;
+info.tau = lo.tau;
+info.rNorm = lo.phi;
+info.numOuter = 0;
+if lo.phi <= sigma
+    return;
+end
+
+for outer = 1:opts.maxOuter
+    info.numOuter = outer;
+    % Newton from the left end lies left of the root, the secant through
+    % both ends right of it
+    tauNewton = lo.tau + (lo.phi-sigma)/max(lo.slope,realmin);
+    if isinf(hi.tau)
+        tau = tauNewton*2.^(0:K-1);
+    elseif K == 1
+        tau = tauNewton;
+    else
+        tauSecant = lo.tau + (lo.phi-sigma)*(hi.tau-lo.tau)/(lo.phi-hi.phi);
+        tau = linspace(min(tauNewton,tauSecant),tauSecant,K);
+    end
+
+    % subproblems, warm-started at the left end (feasible for every tau)
+    [X,R,gNorm] = solveSubproblems(repmat(lo.x,1,K),tau);
+    phi = sqrt(sum(abs(R).^2,1));
+    if opts.verbosity > 0
+        fprintf('spgGroupPareto %3d: tau %s, |r| %s (sigma %.4g), %d products\n',...
+            outer,mat2str(tau,4),mat2str(phi,4),sigma,info.numProducts);
+    end
+
+    % move the ends of the bracket
+    for k=1:K
+        if phi(k) > sigma && tau(k) > lo.tau
+            lo.tau = tau(k); lo.x = X(:,k); lo.r = R(:,k); lo.phi = phi(k);
+            lo.slope = gNorm(k)/max(phi(k),realmin);
+        elseif phi(k) <= sigma && tau(k) < hi.tau
+            hi.tau = tau(k); hi.x = X(:,k); hi.r = R(:,k); hi.phi = phi(k);
+        end
+    end
+    [rError,k] = min(abs(phi-sigma)./max(1,phi));
+    if rError <= opts.optTol
+        x = X(:,k); r = R(:,k);
+        info.tau = tau(k); info.rNorm = phi(k);
+        return;
+    end
+    if ~isinf(hi.tau) && hi.tau-lo.tau <= opts.optTol*hi.tau
+        break;
+    end
+end
+% no root within the tolerance: the feasible end, or the closest point
+if isinf(hi.tau)
+    x = lo.x; r = lo.r; info.tau = lo.tau; info.rNorm = lo.phi;
+else
+    x = hi.x; r = hi.r; info.tau = hi.tau; info.rNorm = hi.phi;
+end
+
+    %% operator on the columns of v, counting the products
+    function y = apply(v,mode)
+        info.numProducts = info.numProducts + size(v,2);
+        y = A(v,mode);
+    end
+
+    %% projection of every column onto its ball sum_g ||x_g|| <= tau(k)
+    function X = project(X,tau)
+        for c=1:size(X,2)
+            X(:,c) = groupL2Project(G,X(:,c),1,tau(c));
+        end
+    end
+
+    %% spectral projected gradient on min ||A*x-b||^2/2 s.t. sum_g ||x_g|| <= tau,
+    % all values of tau together; a column stops iterating once its
+    % relative duality gap is below optTol
+    function [X,R,gNorm] = solveSubproblems(X,tau)
+        numCols = size(X,2);
+        X = project(X,tau);
+        R = b - apply(X,1);
+        g = -apply(R,2);
+        f = sum(abs(R).^2,1)/2;
+        step = ones(1,numCols);
+        for inner = 1:opts.maxInner
+            gNorm = max(groupNorm(g),[],1);
+            gap = real(sum(conj(R).*(R-b),1)) + tau.*gNorm;
+            active = find(abs(gap)./max(1,f) > opts.optTol);
+            if isempty(active)
+                break;
+            end
+            Xa = X(:,active);
+            dx = project(Xa-step(active).*g(:,active),tau(active)) - Xa;
+            descent = real(sum(conj(g(:,active)).*dx,1));
+            lambda = ones(1,length(active));
+            Rn = b - apply(Xa+dx,1);
+            fn = sum(abs(Rn).^2,1)/2;
+            % backtracking along the projected arc for the columns that
+            % do not decrease enough
+            for backtrack = 1:10
+                fail = find(fn > f(active) + 1e-4*lambda.*descent);
+                if isempty(fail)
+                    break;
+                end
+                lambda(fail) = lambda(fail)/2;
+                Rn(:,fail) = b - apply(Xa(:,fail)+lambda(fail).*dx(:,fail),1);
+                fn(fail) = sum(abs(Rn(:,fail)).^2,1)/2;
+            end
+            s = lambda.*dx;
+            gn = -apply(Rn,2);
+            y = gn - g(:,active);
+            sty = real(sum(conj(s).*y,1));
+            % Barzilai-Borwein step
+            newStep = sum(abs(s).^2,1)./max(sty,realmin);
+            newStep(sty <= 0) = 1e10;
+            step(active) = min(max(newStep,1e-10),1e10);
+            X(:,active) = Xa + s;
+            R(:,active) = Rn;
+            g(:,active) = gn;
+            f(active) = fn;
+        end
+        gNorm = max(groupNorm(g),[],1);
+    end
+
+end
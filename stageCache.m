@@ -0,0 +1,80 @@
+%% Content-addressed cache for the outputs of a pipeline stage
+% The key is an MD5 hash over the stage name and every input/parameter
+% that determines the stage output, so a rerun with unchanged inputs finds
+% the artifact produced last time and can skip the computation.
+% inputs
+% cacheDir - folder holding the cached artifacts (created if missing)
+% stageName - name of the stage, e.g. 'autofocus', 'image2d', 'recovery3d'
+% params - struct with the inputs and parameters of the stage. Fields can
+%           be numeric, logical, char, cell or struct. Files can be
+%           described by the output of dir() (name, bytes and datenum are
+%           hashed).
+% outputs
+% cacheFile - '<cacheDir>/<stageName>_<key>.mat'
+% isCached - true if cacheFile already exists
+% stageKey - the hexadecimal key
+
+function [cacheFile,isCached,stageKey] = stageCache(cacheDir,stageName,params)
+
+if ~exist(cacheDir,'dir')
+    mkdir(cacheDir);
+end
+
+md = java.security.MessageDigest.getInstance('MD5');
+hashValue(md,stageName);
+hashValue(md,params);
+stageKey = lower(reshape(dec2hex(typecast(md.digest(),'uint8'),2).',1,[]));
+
+cacheFile = fullfile(cacheDir,sprintf('%s_%s.mat',stageName,stageKey));
+isCached = exist(cacheFile,'file') == 2;
+
+end
+
+%% Feeds a MATLAB value into the digest
+% The class and size are hashed ahead of the data so that, e.g., single(1)
+% and double(1) or a 2x3 and a 3x2 matrix do not collide.
+function hashValue(md,v)
+
+md.update(uint8(sprintf('%s[%s]',class(v),num2str(size(v)))));
+
+if isstruct(v)
+    if isfield(v,'datenum') && isfield(v,'bytes') && isfield(v,'name')
+        % dir() output: hash the file identity instead of all the fields
+        for i=1:numel(v)
+            md.update(uint8(sprintf('%s:%d:%.10f;',v(i).name,v(i).bytes,v(i).datenum)));
+        end
+        return;
+    end
+    names = sort(fieldnames(v));
+    for i=1:numel(names)
+        md.update(uint8(names{i}));
+        for j=1:numel(v)
+            hashValue(md,v(j).(names{i}));
+        end
+    end
+elseif iscell(v)
+    for i=1:numel(v)
+        hashValue(md,v{i});
+    end
+elseif ischar(v)
+    if ~isempty(v)
+        md.update(typecast(uint16(v(:)),'uint8'));
+    end
+elseif isnumeric(v) || islogical(v)
+    if isempty(v)
+        return;
+    end
+    if islogical(v)
+        v = uint8(v);
+    end
+    if isreal(v)
+        md.update(typecast(v(:),'uint8'));
+    else
+        md.update(typecast(real(v(:)),'uint8'));
+        md.update(typecast(imag(v(:)),'uint8'));
+    end
+else
+    error('stageCache:unsupportedType','Cannot hash values of class %s',class(v));
+end
+
+end
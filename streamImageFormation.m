@@ -0,0 +1,260 @@
+%% Streaming image formation: backprojects and focuses pulses as they arrive
+% Pulses are replayed from the spotlighted chunk files of a pass at a fixed
+% PRF (a stand-in for a live feed) and flow through three stages connected
+% by fixed-capacity single-producer/single-consumer ring queues:
+%   1. re-centering of the pulse to the image center (per-pulse part of
+%      SpotlightBasic.m)
+%   2. prominent-point autofocus (PPP_autofocus_twoPass.m) over small
+%      blocks of pulses
+%   3. backprojection of the pulse into a running 2D image (bpPulse.m)
+% The stages run cooperatively in one MATLAB thread, so the queues need no
+% locking: each queue has exactly one writer (advances tail) and one reader
+% (advances head). Pulses that are older than maxLatency when they reach
+% the backprojection stage are dropped so that the image never lags the
+% feed by more than that, and the latency of every backprojected pulse is
+% recorded. By default maxLatency is the time the feed takes to fill one
+% queue, queueLength/prf: a pulse older than that has been overtaken by a
+% whole queue of newer ones.
+%
+% inputs
+% chunkFiles - cell array with the blding620_FP###_0##.mat files of a pass
+%               (output of Batch_Gotcha2006.m), in acquisition order
+% prf - pulse repetition frequency of the replay (Hz)
+% xImage - image coordinates in x direction
+% yImage - image coordinates in y direction
+% NFFT - number of samples in the FFT forming the range profiles
+% opts - (optional) struct with the fields
+%       Center - [x y z] (m) the pulses are re-centered to (default [0 0 0])
+%       AutoFocusEnable - 1 to autofocus the pulses (default 1)
+%       topHatCenter - [x y z] (m) of the top-hat reflector, relative to
+%               Center (default [52.32 121.5 0])
+%       topHatRadius - radius of the top-hat reflector (default 1)
+%       autoFocusBlock - number of pulses focused together (default 32)
+%       numFreqSamples - pulses are zero-padded/truncated to this many
+%               frequency samples (default 1981)
+%       queueLength - capacity of each queue in pulses (default 1024)
+%       maxLatency - pulses older than this (s) are dropped (default
+%               queueLength/prf, inf to never drop)
+%       emitEvery - emitImage is called every emitEvery backprojected
+%               pulses (default 256)
+%       emitImage - handle @(im_final,stats) receiving the running image
+%               (default: none)
+% outputs
+% im_final - the image after the last pulse
+% stats - struct with the per-pulse latency (s) and the number of pulses
+%         dropped because a queue overflowed or maxLatency was exceeded
+
+function [im_final,stats] = streamImageFormation(chunkFiles,prf,xImage,yImage,NFFT,opts)
+
+if nargin < 6
+    opts = struct();
+end
+defaults = struct('Center',[0 0 0],'AutoFocusEnable',1,...
+    'topHatCenter',[52.32 121.5 0],'topHatRadius',1,'autoFocusBlock',32,...
+    'numFreqSamples',1981,'queueLength',1024,'maxLatency',[],...
+    'emitEvery',256,'emitImage',[]);
+names = fieldnames(defaults);
+for i=1:length(names)
+    if ~isfield(opts,names{i})
+        opts.(names{i}) = defaults.(names{i});
+    end
+end
+if isempty(opts.maxLatency)
+    opts.maxLatency = opts.queueLength/prf;
+end
+
+cspeed = 299792458;
+
+[x_mat,y_mat] = meshgrid(xImage,yImage);
+z_mat = zeros(size(x_mat));
+im_final = zeros(size(x_mat));
+
+stats.latency = [];
+stats.droppedQueueFull = 0;
+stats.droppedLatency = 0;
+stats.numBackprojected = 0;
+
+qRaw = queueCreate(opts.queueLength);
+qCentered = queueCreate(opts.queueLength);
+qFocused = queueCreate(opts.queueLength);
+
+r_vec = [];
+numChunks = length(chunkFiles);
+chunkIdx = 0;
+pulseInChunk = 0;
+numPulsesInChunk = 0;
+nextPulse = 1;
+sourceDone = numChunks == 0;
+t0 = tic;
+
+while true
+    tNow = toc(t0);
+
+    %% source: push every pulse whose replay time has come
+    while ~sourceDone && (nextPulse-1)/prf <= tNow
+        if pulseInChunk == numPulsesInChunk
+            chunkIdx = chunkIdx + 1;
+            chunk = load(chunkFiles{chunkIdx},'data');
+            chunk = chunk.data;
+            pulseInChunk = 0;
+            numPulsesInChunk = size(chunk.phdata,2);
+            % presized for numChunks chunks like the first one, at least
+            % doubled when the chunks turn out larger
+            needed = nextPulse-1+numPulsesInChunk;
+            if needed > length(stats.latency)
+                stats.latency(end+1:max([needed numChunks*numPulsesInChunk ...
+                    2*length(stats.latency)])) = NaN;
+            end
+        end
+        pulseInChunk = pulseInChunk + 1;
+        pulse = readPulse(chunk,pulseInChunk,opts.numFreqSamples);
+        pulse.index = nextPulse;
+        pulse.tArrival = (nextPulse-1)/prf;
+        [qRaw,ok] = queuePush(qRaw,pulse);
+        stats.droppedQueueFull = stats.droppedQueueFull + ~ok;
+        nextPulse = nextPulse + 1;
+        sourceDone = chunkIdx == numChunks && pulseInChunk == numPulsesInChunk;
+    end
+
+    %% stage 1: re-center each pulse to the image center
+    while queueSize(qRaw) > 0 && queueSize(qCentered) < qCentered.capacity
+        [qRaw,pulse] = queuePop(qRaw);
+        [qCentered,~] = queuePush(qCentered,recenterPulse(pulse,opts.Center,cspeed));
+    end
+
+    %% stage 2: autofocus blocks of pulses
+    blockSize = min(opts.autoFocusBlock,queueSize(qCentered));
+    if blockSize > 0 && (blockSize == opts.autoFocusBlock || (sourceDone && queueSize(qRaw) == 0)) ...
+            && queueSize(qFocused) + blockSize <= qFocused.capacity
+        block = cell(1,blockSize);
+        for i=1:blockSize
+            [qCentered,block{i}] = queuePop(qCentered);
+        end
+        if opts.AutoFocusEnable == 1
+            block = autofocusBlock(block,opts);
+        end
+        for i=1:blockSize
+            [qFocused,~] = queuePush(qFocused,block{i});
+        end
+    end
+
+    %% stage 3: backproject one pulse per tick so the feed keeps flowing
+    if queueSize(qFocused) > 0
+        [qFocused,pulse] = queuePop(qFocused);
+        if toc(t0) - pulse.tArrival > opts.maxLatency
+            stats.droppedLatency = stats.droppedLatency + 1;
+        else
+            if isempty(r_vec)
+                maxWr = cspeed/(2*pulse.deltaF);
+                r_vec = linspace(-NFFT/2,NFFT/2-1,NFFT)*maxWr/NFFT;
+            end
+            [pulseImage,I] = bpPulse(pulse.phdata,pulse.AntX,pulse.AntY,pulse.AntZ,...
+                pulse.R0,pulse.minF,r_vec,NFFT,x_mat,y_mat,z_mat);
+            im_final(I) = im_final(I) + pulseImage;
+            stats.latency(pulse.index) = toc(t0) - pulse.tArrival;
+            stats.numBackprojected = stats.numBackprojected + 1;
+            if ~isempty(opts.emitImage) && mod(stats.numBackprojected,opts.emitEvery) == 0
+                opts.emitImage(im_final,stats);
+            end
+        end
+    end
+
+    if sourceDone && queueSize(qRaw) == 0 && queueSize(qCentered) == 0 && queueSize(qFocused) == 0
+        break;
+    end
+    if ~sourceDone && queueSize(qRaw) == 0 && queueSize(qCentered) < opts.autoFocusBlock ...
+            && queueSize(qFocused) == 0
+        % idle until the next pulse arrives
+        pause(max(0,(nextPulse-1)/prf - toc(t0)));
+    end
+end
+
+stats.latency = stats.latency(1:nextPulse-1);
+valid = ~isnan(stats.latency);
+stats.meanLatency = mean(stats.latency(valid));
+stats.maxLatency = max(stats.latency(valid));
+fprintf('Streamed %d pulses: %d backprojected, %d dropped (queue full), %d dropped (latency)\n',...
+    nextPulse-1,stats.numBackprojected,stats.droppedQueueFull,stats.droppedLatency);
+fprintf('Latency per pulse: mean %.3f s, max %.3f s\n',stats.meanLatency,stats.maxLatency);
+
+end
+
+%% Extracts pulse n of a spotlighted chunk, normalized to numFreqSamples
+% frequency samples as in Batch_ProceessData_Gotcha_phaseHistoryCorrectionJul12.m
+function pulse = readPulse(data,n,numFreqSamples)
+ph = double(data.phdata(:,n));
+if length(ph) < numFreqSamples
+    ph = [ph; zeros(numFreqSamples-length(ph),1)];
+elseif length(ph) > numFreqSamples
+    ph = ph(1:numFreqSamples);
+end
+pulse.phdata = ph;
+pulse.deltaF = 3.231472355518341e+05;
+pulse.minF = double(data.minF(n));
+pulse.AntX = double(data.AntX(n));
+pulse.AntY = double(data.AntY(n));
+pulse.AntZ = double(data.AntZ(n));
+pulse.R0 = double(data.R0(n));
+pulse.azim = rad2deg(double(data.azim(n)));
+end
+
+%% Re-centers a pulse to Center (see SpotlightBasic.m)
+function pulse = recenterPulse(pulse,Center,cspeed)
+if all(Center == 0)
+    return;
+end
+freq = pulse.minF + pulse.deltaF*(0:length(pulse.phdata)-1).';
+R0new = norm([pulse.AntX-Center(1),pulse.AntY-Center(2),pulse.AntZ-Center(3)]);
+dR = pulse.R0 - R0new;
+pulse.phdata = pulse.phdata.*exp(-1i*4*pi/cspeed*dR*freq);
+pulse.R0 = R0new;
+pulse.AntX = pulse.AntX - Center(1);
+pulse.AntY = pulse.AntY - Center(2);
+pulse.AntZ = pulse.AntZ - Center(3);
+end
+
+%% Runs the prominent-point autofocus over a block of pulses
+function block = autofocusBlock(block,opts)
+numPulses = length(block);
+K = length(block{1}.phdata);
+p1 = zeros(K,numPulses);
+freq = zeros(K,numPulses);
+for i=1:numPulses
+    p1(:,i) = block{i}.phdata;
+    freq(:,i) = block{i}.minF + block{i}.deltaF*(0:K-1).';
+end
+getField = @(name) cellfun(@(p)p.(name),block);
+p1Final = PPP_autofocus_twoPass(opts.topHatCenter(1),opts.topHatCenter(2),...
+    opts.topHatCenter(3),opts.topHatRadius,p1,getField('R0'),freq,...
+    getField('azim'),getField('AntX'),getField('AntY'),getField('AntZ'));
+for i=1:numPulses
+    block{i}.phdata = p1Final(:,i);
+end
+end
+
+%% Fixed-capacity ring queue with one producer and one consumer
+function q = queueCreate(capacity)
+q.items = cell(1,capacity);
+q.capacity = capacity;
+q.head = 0; % number of items popped so far, only advanced by the reader
+q.tail = 0; % number of items pushed so far, only advanced by the writer
+end
+
+function n = queueSize(q)
+n = q.tail - q.head;
+end
+
+function [q,ok] = queuePush(q,item)
+ok = q.tail - q.head < q.capacity;
+if ok
+    q.items{mod(q.tail,q.capacity)+1} = item;
+    q.tail = q.tail + 1;
+end
+end
+
+function [q,item] = queuePop(q)
+slot = mod(q.head,q.capacity)+1;
+item = q.items{slot};
+q.items{slot} = [];
+q.head = q.head + 1;
+end
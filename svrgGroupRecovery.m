@@ -0,0 +1,90 @@
+%% Stochastic variance-reduced start for the joint group-sparse recovery
+% Every iteration of SPGL1 applies the operator to all the measurements of
+% all the passes. This runs a few epochs of projected SVRG [1] on the
+% subproblem
+%     min ||A*x - b||^2/2  s.t.  sum_g ||x_g||_2 <= tau
+% where each inner step only touches one block of measurements (a pass, or
+% a block of pulses of a pass) through its own NUFFT plan. The gradient of
+% block p at x is corrected by its gradient at the snapshot of the epoch
+% and by the full gradient there,
+%     v = P*A_p'*A_p*(x - xSnap) + A'*(A*xSnap - b),
+% so the steps stay unbiased while their variance vanishes as x approaches
+% the snapshot. A sweep over the P blocks costs about one full gradient
+% and moves x P times. The step is set once per epoch by the
+% Barzilai-Borwein rule of [2]. tau is the Newton step of the Pareto curve
+% from zero, which lies left of the root, so the full-data solve started
+% at the result (spgGroupOptions.m, spgGroupPareto.m) only has a short
+% way to go.
+%
+% inputs
+% A - full operator @(x,mode)
+% b - measurements
+% groups - group of every unknown
+% sigma - bound on the norm of the residual
+% blockOperators - cell array with the operator @(x,mode) of every block,
+%                  mapping to the measurements b(blockRows{p}): the rows
+%                  of A, with the same scaling, so that the A_p'*A_p sum
+%                  to A'*A
+% blockRows - cell array with the rows of b of every block
+% numEpochs - number of epochs (one full gradient plus one sweep over the
+%             blocks each)
+% outputs
+% x - starting point for the full-data solve
+% info - struct with tau, the step of every epoch and the residual norm
+%        at every snapshot
+%
+% [1] L. Xiao and T. Zhang, "A proximal stochastic gradient method with
+% progressive variance reduction," SIAM J. Optim., 2014.
+% [2] C. Tan, S. Ma, Y.-H. Dai and Y. Qian, "Barzilai-Borwein step size
+% for stochastic gradient descent," NIPS, 2016.
+
+function [x,info] = svrgGroupRecovery(A,b,groups,sigma,blockOperators,blockRows,numEpochs)
+
+b = b(:);
+P = length(blockOperators);
+[~,~,groupIndex] = unique(groups(:));
+G = sparse(groupIndex,1:length(groupIndex),1);
+
+% tau of the Newton step from x = 0
+g = A(b,2);
+info.tau = (norm(b)-sigma)*norm(b)/max(sqrt(G*abs(g).^2));
+x = zeros(size(g));
+if info.tau <= 0
+    return;
+end
+
+% first step from the largest block: 1/(P*||A_p||^2) by power iteration
+[~,p] = max(cellfun(@length,blockRows));
+v = randn(size(x));
+for i=1:5
+    v = blockOperators{p}(blockOperators{p}(v/norm(v),1),2);
+end
+step = 1/(P*norm(v));
+
+info.step = zeros(1,numEpochs);
+info.rNorm = zeros(1,numEpochs);
+for epoch = 1:numEpochs
+    xSnap = x;
+    r = A(xSnap,1) - b;
+    info.rNorm(epoch) = norm(r);
+    mu = A(r,2);
+    if epoch > 1
+        % Barzilai-Borwein step over one epoch of P inner steps
+        s = xSnap - xPrev;
+        y = mu - muPrev;
+        sty = real(s'*y);
+        if sty > 0
+            step = norm(s)^2/(P*sty);
+        end
+    end
+    info.step(epoch) = step;
+    fprintf('SVRG epoch %d: |r| %.4g (sigma %.4g), step %.3g\n',epoch,info.rNorm(epoch),sigma,step);
+    xPrev = xSnap;
+    muPrev = mu;
+    for p = randperm(P)
+        v = P*blockOperators{p}(blockOperators{p}(x-xSnap,1),2) + mu;
+        x = groupL2Project(G,x-step*v,1,info.tau);
+    end
+end
+
+end
@@ -0,0 +1,136 @@
+%% Per-pixel tomographic height estimation from the co-registered passes
+% Every pixel of the P pass images is a P-element vector y sampling the
+% reflectivity of its z-column at the vertical wavenumbers kz of the
+% passes,
+%     y_p = sum_z s(z)*exp(1i*2*pi*kz(p)*z),
+% so a spectrum over the heights zAxis estimates the column without the
+% sparse solve of JointSparseRecovery_3D.m. With a(z) the steering vector
+% of height z and R the sample covariance of y over a window of pixels
+% (with diagonal loading),
+%     beamforming:  S(z) = a(z)'*R*a(z)/P^2
+%     Capon:        S(z) = 1/(a(z)'*R^-1*a(z))
+% Capon resolves scatterers closer than the Rayleigh resolution of the
+% passes, at the cost of the window. The pixels are processed in blocks of
+% image columns, all pixels of a block at once: beamforming is one matrix
+% product of the block with the steering matrix, and the P x P Cholesky
+% factorizations and triangular solves of Capon are unrolled over the
+% entries of the matrices and vectorized over the pixels.
+% inputs
+% images - 1 x P cell array of co-registered complex images (nx x ny)
+% kz - vertical wavenumbers of the passes (cycles/m), relative to a common
+%      reference
+% zAxis - heights (m) of the spectrum
+% opts - (optional) struct with the fields
+%       method - 'capon' or 'beamforming' (default 'capon')
+%       window - [wx wy] pixels averaged into the covariance (default
+%               [5 5])
+%       loading - diagonal loading of R, relative to its mean diagonal
+%               (default 1e-2)
+%       blockPixels - pixels per block (default 8192)
+% outputs
+% zIndex - nx x ny index into zAxis of the maximum of every spectrum
+% peakValue - nx x ny complex amplitude at that height, a(z)'*y/P
+% peakPower - nx x ny value of the spectrum there
+% spectrum - (optional) numel(zAxis) x nx x ny single spectra, z fastest
+
+function [zIndex,peakValue,peakPower,spectrum] = tomoHeightEstimate(images,kz,zAxis,opts)
+
+if nargin < 4
+    opts = struct();
+end
+defaults = struct('method','capon','window',[5 5],'loading',1e-2,'blockPixels',8192);
+names = fieldnames(defaults);
+for i=1:length(names)
+    if ~isfield(opts,names{i})
+        opts.(names{i}) = defaults.(names{i});
+    end
+end
+P = length(images);
+[nx,ny] = size(images{1});
+numZ = length(zAxis);
+useCapon = strcmpi(opts.method,'capon');
+% steering matrix, P x numZ
+A = exp(1i*2*pi*kz(:)*zAxis(:).');
+halo = floor(opts.window(2)/2);
+blockCols = max(1,floor(opts.blockPixels/nx));
+
+zIndex = zeros(nx,ny);
+peakValue = zeros(nx,ny);
+peakPower = zeros(nx,ny);
+if nargout > 3
+    spectrum = zeros(numZ,nx,ny,'single');
+end
+for c0 = 1:blockCols:ny
+    cols = c0:min(c0+blockCols-1,ny);
+    readCols = max(cols(1)-halo,1):min(cols(end)+halo,ny);
+    central = cols - readCols(1) + 1;
+    Y = zeros(nx*length(readCols),P);
+    for p=1:P
+        Y(:,p) = reshape(images{p}(:,readCols),[],1);
+    end
+    % beamformer output of every pixel at every height
+    B = reshape(Y*conj(A)/P,nx,length(readCols),numZ);
+    if useCapon
+        S = caponSpectrum(windowCovariance(Y,nx,central,opts),A);
+    else
+        % a'*R*a of the windowed covariance is the windowed |a'*y|^2
+        S = movmean(movmean(abs(B).^2,opts.window(1),1),opts.window(2),2);
+        S = reshape(S(:,central,:),[],numZ);
+    end
+    B = reshape(B(:,central,:),[],numZ);
+    [peak,zi] = max(S,[],2);
+    zIndex(:,cols) = reshape(zi,nx,[]);
+    peakPower(:,cols) = reshape(peak,nx,[]);
+    peakValue(:,cols) = reshape(B(sub2ind(size(B),(1:size(B,1)).',zi)),nx,[]);
+    if nargout > 3
+        spectrum(:,:,cols) = reshape(single(S).',numZ,nx,[]);
+    end
+end
+
+end
+
+%% Windowed sample covariance of the central columns, with diagonal
+% loading, as an n x P x P array
+function R = windowCovariance(Y,nx,central,opts)
+P = size(Y,2);
+n = nx*length(central);
+R = zeros(n,P,P);
+for p=1:P
+    for q=p:P
+        Rpq = reshape(Y(:,p).*conj(Y(:,q)),nx,[]);
+        Rpq = movmean(movmean(Rpq,opts.window(1),1),opts.window(2),2);
+        R(:,p,q) = reshape(Rpq(:,central),[],1);
+        R(:,q,p) = conj(R(:,p,q));
+    end
+end
+loading = opts.loading*real(sum(R(:,(0:P-1)*(P+1)+1),2))/P;
+for p=1:P
+    R(:,p,p) = real(R(:,p,p)) + loading + realmin;
+end
+end
+
+%% Capon spectrum 1/(a'*R^-1*a) = 1/||L^-1*a||^2 with R = L*L', for every
+% pixel (rows of R) and height (columns of A)
+function S = caponSpectrum(R,A)
+[n,P,~] = size(R);
+% Cholesky factors, column by column
+L = zeros(n,P,P);
+for j=1:P
+    L(:,j,j) = sqrt(max(real(R(:,j,j)) - sum(abs(L(:,j,1:j-1)).^2,3),realmin));
+    for i=j+1:P
+        L(:,i,j) = (R(:,i,j) - sum(L(:,i,1:j-1).*conj(L(:,j,1:j-1)),3))./L(:,j,j);
+    end
+end
+% forward substitution L*W = a for all heights, accumulating ||W||^2
+W = cell(1,P);
+normW = zeros(n,size(A,2));
+for i=1:P
+    W{i} = A(i,:);
+    for j=1:i-1
+        W{i} = W{i} - L(:,i,j).*W{j};
+    end
+    W{i} = W{i}./L(:,i,i);
+    normW = normW + abs(W{i}).^2;
+end
+S = 1./normW;
+end
@@ -0,0 +1,61 @@
+%% Storage order of the voxels of the 3D volume
+% Describes where voxel (i_x,i_y,i_z) of an N(1) x N(2) x N(3) volume sits
+% in the vectors of the solver, so the NUFFT (FGG_Plan3D 'crop' and 'pad'),
+% the solver and the extraction of the points all address the voxels in the
+% same order and none of them has to reshape and permute the volume into
+% the order of another. The order lists the axes fastest first, e.g. 'zxy'
+% (z fastest, then x, then y, the order of sar_operator_nufft_3d_plan.m) or
+% 'xyz'. A block other than [1 1 1] stores the volume as bricks of
+% block(1) x block(2) x block(3) voxels, the voxels of a brick and the
+% bricks themselves both in that order, so neighbouring voxels in every
+% direction stay close in memory.
+% inputs
+% N - [N_x N_y N_z] size of the volume
+% order - (optional) axes fastest first, a permutation of 'xyz' (default
+%         'zxy')
+% block - (optional) [b_x b_y b_z] size of the bricks, dividing N (default
+%         [1 1 1], no bricks)
+% outputs
+% layout - struct with N, order, block and offset: offset{d}(i+1) is the
+%          0-based contribution of index i along axis d, so voxel
+%          (i_x,i_y,i_z) is element
+%          offset{1}(i_x)+offset{2}(i_y)+offset{3}(i_z)+1
+%          (voxelLayoutIndex.m, voxelLayoutSubscripts.m)
+
+function layout = voxelLayout(N,order,block)
+
+if nargin < 2 || isempty(order)
+    order = 'zxy';
+end
+if nargin < 3 || isempty(block)
+    block = [1 1 1];
+end
+N = N(:).';
+block = block(:).';
+perm = arrayfun(@(c)find('xyz' == c),lower(order));
+if ~isequal(sort(perm),1:3)
+    error('voxelLayout:order','The order %s is not a permutation of xyz.',order);
+end
+if any(mod(N,block))
+    error('voxelLayout:block','The block %s does not divide the volume %s.',...
+        mat2str(block),mat2str(N));
+end
+
+% strides of the axes inside a brick and of the bricks
+numBlocks = N./block;
+inStride = zeros(1,3);
+blockStride = zeros(1,3);
+inStride(perm) = cumprod([1 block(perm(1:2))]);
+blockStride(perm) = prod(block)*cumprod([1 numBlocks(perm(1:2))]);
+
+layout.N = N;
+layout.order = lower(order);
+layout.block = block;
+layout.perm = perm;
+layout.offset = cell(1,3);
+for d=1:3
+    i = (0:N(d)-1).';
+    layout.offset{d} = mod(i,block(d))*inStride(d) + floor(i/block(d))*blockStride(d);
+end
+
+end
@@ -0,0 +1,13 @@
+%% Linear indices of voxels in a voxel layout
+% inputs
+% layout - voxel layout (voxelLayout.m)
+% ix, iy, iz - 1-based subscripts of the voxels (arrays of the same size)
+% outputs
+% idx - 1-based indices of the voxels in the vectors of that layout
+
+function idx = voxelLayoutIndex(layout,ix,iy,iz)
+
+idx = layout.offset{1}(ix) + layout.offset{2}(iy) + layout.offset{3}(iz) + 1;
+idx = reshape(idx,size(ix));
+
+end
@@ -0,0 +1,23 @@
+%% Subscripts of voxels from their indices in a voxel layout
+% The inverse of voxelLayoutIndex.m, e.g. to find the coordinates of the
+% voxels kept from a solution.
+% inputs
+% layout - voxel layout (voxelLayout.m)
+% idx - 1-based indices of the voxels in the vectors of that layout
+% outputs
+% ix, iy, iz - 1-based subscripts of the voxels (same size as idx)
+
+function [ix,iy,iz] = voxelLayoutSubscripts(layout,idx)
+
+numBlocks = layout.N./layout.block;
+within = mod(idx-1,prod(layout.block));
+blockIndex = floor((idx-1)/prod(layout.block));
+sub = cell(1,3);
+for d = layout.perm
+    sub{d} = mod(blockIndex,numBlocks(d))*layout.block(d) + mod(within,layout.block(d)) + 1;
+    within = floor(within/layout.block(d));
+    blockIndex = floor(blockIndex/numBlocks(d));
+end
+[ix,iy,iz] = sub{:};
+
+end
@@ -0,0 +1,79 @@
+%% Writes a recovered 3D reflectivity as a sparse volume
+% Keeps every voxel within floorDb dB of the maximum, stored per z-column
+% as runs of consecutive voxels: the solution of the joint sparse recovery
+% is zero (or far below the maximum) in most columns and, in the others,
+% occupies a few height bands, so a run costs two 16-bit numbers on top of
+% its single-precision complex values. readSparseVolume.m extracts points
+% above any threshold from it without re-solving the aperture.
+% JointSparseRecovery_3D.m writes the output of the solver, whose
+% amplitudes keep its shrinkage, together with the detected points and
+% their amplitudes refitted by debiasRecovery_3D.m, which are the points of
+% Results_3D_###.mat. The detected points are stored even below floorDb.
+%
+% The file holds
+%   M - [M_z M_1 M_2] size of the volume, z fastest
+%   zAxis, axis1, axis2 - coordinates (m) of the voxels along the three
+%           dimensions
+%   maxAbs, floorDb - largest magnitude and the floor of the stored voxels
+%   columnRuns - uint32, the runs of column c (numbered along dimension 2,
+%           then 3) are columnRuns(c)+1:columnRuns(c+1)
+%   runStart, runLength - uint16, first z index (0-based) and length of
+%           every run
+%   values - single complex values of the runs, one after the other
+%   detected - (with the detected points) logical, the stored voxels that
+%           are detected points
+%   debiasedValues - single complex debiased values of the detected
+%           voxels, in the order of values
+% inputs
+% fileName - .mat file to write
+% x - volume as a vector, z fastest, or in the order of layout
+% M - [M_z M_1 M_2] size of the volume
+% zAxis, axis1, axis2 - coordinates of the voxels along the dimensions
+% floorDb - voxels within floorDb dB of the maximum are stored
+% layout - (optional) voxel layout of x (voxelLayout.m, with N =
+%          [M_1 M_2 M_z]); only the stored voxels are put in z-fastest
+%          order, the volume itself is not permuted ([]: z fastest)
+% points - (optional) indices of the detected points in x
+% pointValues - (optional) their debiased values
+
+function writeSparseVolume(fileName,x,M,zAxis,axis1,axis2,floorDb,layout,points,pointValues)
+
+maxAbs = max(abs(x));
+source = find(abs(x) > maxAbs*10^(-floorDb/20));
+if nargin > 8
+    source = union(source,points(:));
+end
+if nargin > 7 && ~isempty(layout)
+    [i1,i2,iz] = voxelLayoutSubscripts(layout,source);
+    [idx,order] = sort((iz-1) + M(1)*((i1-1) + M(2)*(i2-1)));
+    source = source(order);
+    clear i1 i2 iz order;
+else
+    idx = source - 1;
+end
+z = mod(idx,M(1));
+column = (idx-z)/M(1);
+% a run starts where the previous stored voxel is not the one below it in
+% the same column
+first = diff([-2; idx]) ~= 1 | z == 0;
+runFirst = find(first);
+runStart = uint16(z(runFirst));
+runLength = uint16(diff([runFirst; length(idx)+1]));
+columnRuns = uint32([0; cumsum(accumarray(column(runFirst)+1,1,[M(2)*M(3) 1]))]);
+values = single(x(source));
+if isreal(values)
+    values = complex(values);
+end
+fields = {'M','zAxis','axis1','axis2','maxAbs','floorDb','columnRuns',...
+    'runStart','runLength','values'};
+if nargin > 8
+    [detected,point] = ismember(source,points(:));
+    pointValues = pointValues(:);
+    debiasedValues = complex(single(pointValues(point(detected))));
+    fields = [fields {'detected','debiasedValues'}];
+end
+clear source idx z column first runFirst point;
+
+save(fileName,fields{:},'-v7.3');
+
+end